@@ -0,0 +1,112 @@
+#ifndef BENCH_HIST_H
+#define BENCH_HIST_H
+
+/*
+ * Helpers shared by the userspace benchmarks of the labs: a monotonic clock
+ * in nanoseconds and the latency histograms the percentiles are read from.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Latency histogram with 16 linear sub-buckets per power of two, so every
+ * bucket is at most 1/16th wide relative to its value.
+ */
+#define HIST_SUB_BITS	    4
+#define HIST_SUB_COUNT	    (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	    (64 * HIST_SUB_COUNT)
+
+struct histogram {
+	uint64_t buckets[HIST_BUCKETS];
+	uint64_t count;
+};
+
+/**
+ * @brief Returns the index of the histogram bucket holding a value
+ *
+ * @param ns Latency in nanoseconds
+ * @return unsigned int
+ */
+static inline unsigned int hist_index(uint64_t ns)
+{
+	int msb;
+	int shift;
+
+	if (ns < HIST_SUB_COUNT) {
+		return ns;
+	}
+	msb = 63 - __builtin_clzll(ns);
+	shift = msb - HIST_SUB_BITS;
+	return ((shift + 1) << HIST_SUB_BITS) +
+	       ((ns >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+/**
+ * @brief Returns the smallest value of a histogram bucket
+ *
+ * @param index Index of the bucket
+ * @return uint64_t
+ */
+static inline uint64_t hist_value(unsigned int index)
+{
+	unsigned int shift;
+
+	if (index < HIST_SUB_COUNT) {
+		return index;
+	}
+	shift = (index >> HIST_SUB_BITS) - 1;
+	return (uint64_t)(HIST_SUB_COUNT + (index & (HIST_SUB_COUNT - 1)))
+	       << shift;
+}
+
+static inline void hist_add(struct histogram *hist, uint64_t ns)
+{
+	hist->buckets[hist_index(ns)]++;
+	hist->count++;
+}
+
+static inline void hist_merge(struct histogram *dst,
+			      const struct histogram *src)
+{
+	for (size_t i = 0; i < HIST_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+	dst->count += src->count;
+}
+
+/**
+ * @brief Returns the latency under which a fraction of the samples fall
+ *
+ * @param hist
+ * @param fraction Between 0 and 1, eg 0.99 for the p99
+ * @return uint64_t Latency in nanoseconds, 0 if the histogram is empty
+ */
+static inline uint64_t hist_percentile(const struct histogram *hist,
+				       double fraction)
+{
+	uint64_t rank = (uint64_t)(fraction * hist->count);
+	uint64_t seen = 0;
+
+	if (hist->count == 0) {
+		return 0;
+	}
+	for (size_t i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen > rank) {
+			return hist_value(i);
+		}
+	}
+	return hist_value(HIST_BUCKETS - 1);
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif /* BENCH_HIST_H */
@@ -0,0 +1,454 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include "../helper/bench_hist.h"
+#include "flifo_module/flifo.h"
+
+#define DEFAULT_DEVICE	    "/dev/flifo0"
+#define DEFAULT_DURATION_MS 1000
+#define DEFAULT_CAPACITY    (64 * 1024)
+#define MAX_LIST	    16
+#define MAX_THREADS	    64
+// Period at which a waiting thread checks if the run is over
+#define POLL_TIMEOUT_MS	    10
+
+struct mode_name {
+	const char *name;
+	int mode;
+};
+
+static const struct mode_name modes[] = {
+	{ "fifo", MODE_FIFO },
+	{ "lifo", MODE_LIFO },
+	{ "prio", MODE_PRIO },
+	{ "relaxed", MODE_RELAXED },
+};
+
+// One point of the sweep
+struct bench_case {
+	const struct mode_name *mode;
+	size_t value_size;
+	size_t batch;
+	int producers;
+	int consumers;
+};
+
+// State of a producer or consumer thread
+struct worker {
+	pthread_t thread;
+	const struct bench_case *bc;
+	int is_producer;
+	uint64_t bytes;
+	uint64_t calls;
+	struct histogram hist;
+	int error;
+};
+
+static const char *device = DEFAULT_DEVICE;
+static unsigned long capacity = DEFAULT_CAPACITY;
+static long duration_ms = DEFAULT_DURATION_MS;
+
+static pthread_barrier_t start_barrier;
+static volatile int stop;
+
+/**
+ * @brief Body of the producer and consumer threads. Each thread has its own
+ * non blocking file and waits with poll so that it notices the end of the
+ * run. Only the calls that moved values are timed.
+ *
+ * @param arg The struct worker of the thread
+ * @return void*
+ */
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	const size_t count = w->bc->batch * w->bc->value_size;
+	struct pollfd pfd = { .events = w->is_producer ? POLLOUT : POLLIN };
+	uint8_t *buffer;
+	uint64_t start;
+	ssize_t ret;
+	int fd;
+
+	buffer = calloc(1, count);
+	fd = open(device, (w->is_producer ? O_WRONLY : O_RDONLY) | O_NONBLOCK);
+	if (buffer == NULL || fd < 0) {
+		w->error = errno;
+		pthread_barrier_wait(&start_barrier);
+		free(buffer);
+		return NULL;
+	}
+	// Vary the values so the priority mode has some work to do
+	for (size_t i = 0; i < count; i++) {
+		buffer[i] = rand();
+	}
+	pfd.fd = fd;
+
+	pthread_barrier_wait(&start_barrier);
+	while (!stop) {
+		start = now_ns();
+		ret = w->is_producer ? write(fd, buffer, count) :
+				       read(fd, buffer, count);
+		if (ret > 0) {
+			hist_add(&w->hist, now_ns() - start);
+			w->bytes += ret;
+			w->calls++;
+		} else if (ret < 0 && errno == EAGAIN) {
+			poll(&pfd, 1, POLL_TIMEOUT_MS);
+		} else {
+			w->error = ret < 0 ? errno : EIO;
+			break;
+		}
+	}
+
+	close(fd);
+	free(buffer);
+	return NULL;
+}
+
+/**
+ * @brief Configures the list for a case
+ *
+ * @param fd
+ * @param bc
+ * @return int 0 on success, -1 with errno set otherwise
+ */
+static int setup_list(int fd, const struct bench_case *bc)
+{
+	if (ioctl(fd, FLIFO_CMD_CHANGE_MODE, MODE_FIFO) < 0 ||
+	    ioctl(fd, FLIFO_CMD_SET_CAPACITY, capacity) < 0 ||
+	    ioctl(fd, FLIFO_CMD_CHANGE_VALUE_SIZE, bc->value_size) < 0 ||
+	    ioctl(fd, FLIFO_CMD_CHANGE_MODE, bc->mode->mode) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Runs one case of the sweep and writes its CSV line
+ *
+ * @param fd  Control file of the device
+ * @param bc  The case to run
+ * @param csv Output of the results
+ * @return int 0 on success, -1 otherwise
+ */
+static int run_case(int fd, const struct bench_case *bc, FILE *csv)
+{
+	const int nb_workers = bc->producers + bc->consumers;
+	struct worker *workers;
+	struct histogram *write_hist;
+	struct histogram *read_hist;
+	uint64_t read_bytes = 0;
+	uint64_t read_calls = 0;
+	uint64_t start;
+	double seconds;
+	int rc = -1;
+	int i;
+
+	if (bc->batch * bc->value_size > capacity) {
+		fprintf(stderr, "Skipping %s size %zu batch %zu: too big\n",
+			bc->mode->name, bc->value_size, bc->batch);
+		return 0;
+	}
+	if (setup_list(fd, bc) < 0) {
+		perror("ioctl:");
+		return -1;
+	}
+
+	workers = calloc(nb_workers, sizeof(*workers));
+	write_hist = calloc(1, sizeof(*write_hist));
+	read_hist = calloc(1, sizeof(*read_hist));
+	if (workers == NULL || write_hist == NULL || read_hist == NULL) {
+		perror("calloc:");
+		goto end;
+	}
+
+	stop = 0;
+	pthread_barrier_init(&start_barrier, NULL, nb_workers + 1);
+	for (i = 0; i < nb_workers; i++) {
+		workers[i].bc = bc;
+		workers[i].is_producer = i < bc->producers;
+		if (pthread_create(&workers[i].thread, NULL, worker_run,
+				   &workers[i]) != 0) {
+			// Can't recover from a missing thread at the barrier
+			perror("pthread_create:");
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_barrier_wait(&start_barrier);
+	start = now_ns();
+	usleep(duration_ms * 1000);
+	stop = 1;
+	for (i = 0; i < nb_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	seconds = (now_ns() - start) / 1e9;
+	pthread_barrier_destroy(&start_barrier);
+
+	for (i = 0; i < nb_workers; i++) {
+		if (workers[i].error != 0) {
+			fprintf(stderr, "Worker %d failed: %s\n", i,
+				strerror(workers[i].error));
+			goto end;
+		}
+		if (workers[i].is_producer) {
+			hist_merge(write_hist, &workers[i].hist);
+		} else {
+			hist_merge(read_hist, &workers[i].hist);
+			read_bytes += workers[i].bytes;
+			read_calls += workers[i].calls;
+		}
+	}
+
+	// The throughput is what reached the consumers
+	fprintf(csv,
+		"%s,%zu,%zu,%d,%d,%.3f,%" PRIu64 ",%" PRIu64
+		",%.0f,%.3f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+		",%" PRIu64 ",%" PRIu64 "\n",
+		bc->mode->name, bc->value_size, bc->batch, bc->producers,
+		bc->consumers, seconds, read_calls,
+		read_bytes / bc->value_size,
+		read_bytes / bc->value_size / seconds,
+		read_bytes / seconds / (1024 * 1024),
+		hist_percentile(write_hist, 0.5),
+		hist_percentile(write_hist, 0.99),
+		hist_percentile(write_hist, 0.999),
+		hist_percentile(read_hist, 0.5),
+		hist_percentile(read_hist, 0.99),
+		hist_percentile(read_hist, 0.999));
+	fflush(csv);
+	fprintf(stderr,
+		"%-8s size %zu batch %-4zu %dp/%dc: %12.0f values/s "
+		"%9.3f MB/s read p50/p99/p999 %" PRIu64 "/%" PRIu64
+		"/%" PRIu64 " ns\n",
+		bc->mode->name, bc->value_size, bc->batch, bc->producers,
+		bc->consumers, read_bytes / bc->value_size / seconds,
+		read_bytes / seconds / (1024 * 1024),
+		hist_percentile(read_hist, 0.5),
+		hist_percentile(read_hist, 0.99),
+		hist_percentile(read_hist, 0.999));
+	rc = 0;
+end:
+	free(workers);
+	free(write_hist);
+	free(read_hist);
+	return rc;
+}
+
+/**
+ * @brief Parses a comma separated list of positive numbers
+ *
+ * @param arg    The list, eg "1,2,4,8"
+ * @param values Destination of the numbers
+ * @return int Number of values parsed, -1 if the list is invalid
+ */
+static int parse_list(const char *arg, size_t *values)
+{
+	char *end;
+	int count = 0;
+
+	while (*arg != '\0' && count < MAX_LIST) {
+		values[count] = strtoul(arg, &end, 0);
+		if (end == arg || values[count] == 0) {
+			return -1;
+		}
+		count++;
+		if (*end == '\0') {
+			return count;
+		}
+		if (*end != ',') {
+			return -1;
+		}
+		arg = end + 1;
+	}
+	return -1;
+}
+
+/**
+ * @brief Parses a comma separated list of thread counts, each one written
+ * producers:consumers
+ *
+ * @param arg       The list, eg "1:1,2:2"
+ * @param producers Destination of the producer counts
+ * @param consumers Destination of the consumer counts
+ * @return int Number of pairs parsed, -1 if the list is invalid
+ */
+static int parse_threads(const char *arg, int *producers, int *consumers)
+{
+	int count = 0;
+	int len;
+
+	while (*arg != '\0' && count < MAX_LIST) {
+		if (sscanf(arg, "%d:%d%n", &producers[count],
+			   &consumers[count], &len) != 2 ||
+		    producers[count] < 1 || consumers[count] < 1 ||
+		    producers[count] + consumers[count] > MAX_THREADS) {
+			return -1;
+		}
+		count++;
+		arg += len;
+		if (*arg == '\0') {
+			return count;
+		}
+		if (*arg != ',') {
+			return -1;
+		}
+		arg++;
+	}
+	return -1;
+}
+
+/**
+ * @brief Parses a comma separated list of mode names
+ *
+ * @param arg      The list, eg "fifo,lifo"
+ * @param selected Destination of the modes
+ * @return int Number of modes parsed, -1 if the list is invalid
+ */
+static int parse_modes(const char *arg, const struct mode_name **selected)
+{
+	char *list = strdup(arg);
+	char *saveptr;
+	int count = 0;
+	size_t i;
+
+	for (char *name = strtok_r(list, ",", &saveptr); name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+			if (strcmp(name, modes[i].name) == 0) {
+				break;
+			}
+		}
+		if (i == sizeof(modes) / sizeof(modes[0]) ||
+		    count == MAX_LIST) {
+			free(list);
+			return -1;
+		}
+		selected[count++] = &modes[i];
+	}
+	free(list);
+	return count ? count : -1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d device     device to benchmark (default %s)\n"
+		"  -m modes      modes among fifo,lifo,prio,relaxed "
+		"(default fifo,lifo)\n"
+		"  -s sizes      value sizes (default 1,2,4,8)\n"
+		"  -b batches    values per read or write (default 1,16,256)\n"
+		"  -p threads    producers:consumers pairs (default 1:1,2:2,4:4)\n"
+		"  -c capacity   capacity of the list in bytes (default %d)\n"
+		"  -t duration   duration of each case in ms (default %d)\n"
+		"  -o file       CSV output (default stdout)\n",
+		name, DEFAULT_DEVICE, DEFAULT_CAPACITY, DEFAULT_DURATION_MS);
+}
+
+int main(int argc, char **argv)
+{
+	const struct mode_name *selected_modes[MAX_LIST] = { &modes[0],
+							     &modes[1] };
+	size_t sizes[MAX_LIST] = { 1, 2, 4, 8 };
+	size_t batches[MAX_LIST] = { 1, 16, 256 };
+	int producers[MAX_LIST] = { 1, 2, 4 };
+	int consumers[MAX_LIST] = { 1, 2, 4 };
+	int nb_modes = 2;
+	int nb_sizes = 4;
+	int nb_batches = 3;
+	int nb_threads = 3;
+	FILE *csv = stdout;
+	struct bench_case bc;
+	int rc = EXIT_SUCCESS;
+	int opt;
+	int fd;
+
+	while ((opt = getopt(argc, argv, "d:m:s:b:p:c:t:o:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'm':
+			nb_modes = parse_modes(optarg, selected_modes);
+			break;
+		case 's':
+			nb_sizes = parse_list(optarg, sizes);
+			break;
+		case 'b':
+			nb_batches = parse_list(optarg, batches);
+			break;
+		case 'p':
+			nb_threads = parse_threads(optarg, producers, consumers);
+			break;
+		case 'c':
+			capacity = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			duration_ms = strtol(optarg, NULL, 0);
+			break;
+		case 'o':
+			csv = fopen(optarg, "w");
+			if (csv == NULL) {
+				perror("fopen:");
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (nb_modes < 0 || nb_sizes < 0 || nb_batches < 0 ||
+	    nb_threads < 0 || duration_ms <= 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0) {
+		printf("Error opening %s\n", device);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(csv, "mode,value_size,batch,producers,consumers,seconds,"
+		     "reads,values,values_per_s,mb_per_s,"
+		     "write_p50_ns,write_p99_ns,write_p999_ns,"
+		     "read_p50_ns,read_p99_ns,read_p999_ns\n");
+	for (int m = 0; m < nb_modes; m++) {
+		for (int s = 0; s < nb_sizes; s++) {
+			for (int b = 0; b < nb_batches; b++) {
+				for (int t = 0; t < nb_threads; t++) {
+					bc.mode = selected_modes[m];
+					bc.value_size = sizes[s];
+					bc.batch = batches[b];
+					bc.producers = producers[t];
+					bc.consumers = consumers[t];
+					if (run_case(fd, &bc, csv) < 0) {
+						rc = EXIT_FAILURE;
+						goto end;
+					}
+				}
+			}
+		}
+	}
+end:
+	// Leave the list as the other tools expect it
+	ioctl(fd, FLIFO_CMD_CHANGE_MODE, MODE_FIFO);
+	ioctl(fd, FLIFO_CMD_SET_CAPACITY, FLIFO_DEFAULT_CAPACITY);
+	ioctl(fd, FLIFO_CMD_CHANGE_VALUE_SIZE, 1);
+	close(fd);
+	if (csv != stdout) {
+		fclose(csv);
+	}
+	return rc;
+}
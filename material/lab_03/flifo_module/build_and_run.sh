@@ -2,4 +2,4 @@
 
 make
 rmmod flifo 
-insmod flifo.ko && chmod 666 /dev/flifo
\ No newline at end of file
+insmod flifo.ko && chmod 666 /dev/flifo*
\ No newline at end of file
@@ -6,14 +6,157 @@
 #else
 #include <sys/ioctl.h>
 #endif
+#include <linux/types.h>
 
 #define FLIFO_IOC_MAGIC		    '+'
 
 #define FLIFO_CMD_RESET		    _IO(FLIFO_IOC_MAGIC, 0)
 #define FLIFO_CMD_CHANGE_MODE	    _IOW(FLIFO_IOC_MAGIC, 1, int)
 #define FLIFO_CMD_CHANGE_VALUE_SIZE _IOW(FLIFO_IOC_MAGIC, 2, int)
+#define FLIFO_CMD_SET_CAPACITY	    _IOW(FLIFO_IOC_MAGIC, 3, unsigned long)
+#define FLIFO_CMD_DOORBELL	    _IO(FLIFO_IOC_MAGIC, 4)
+#define FLIFO_CMD_PUSH_BATCH	    _IOW(FLIFO_IOC_MAGIC, 5, struct flifo_batch)
+#define FLIFO_CMD_POP_BATCH	    _IOW(FLIFO_IOC_MAGIC, 6, struct flifo_batch)
+#define FLIFO_CMD_SET_PRIO_ORDER    _IOW(FLIFO_IOC_MAGIC, 7, int)
+#define FLIFO_CMD_PEEK_LEN	    _IOR(FLIFO_IOC_MAGIC, 8, __u32)
+#define FLIFO_CMD_SET_EVENTFD	    _IOW(FLIFO_IOC_MAGIC, 9, struct flifo_eventfd)
+#define FLIFO_CMD_SET_TIMESTAMPS    _IOW(FLIFO_IOC_MAGIC, 10, int)
+#define FLIFO_CMD_SET_TTL	    _IOW(FLIFO_IOC_MAGIC, 11, unsigned long)
+
+/*
+ * With FLIFO_CMD_SET_TIMESTAMPS enabled, each value written in MODE_FIFO or
+ * MODE_LIFO is stamped and the time it spent in the list is accounted in the
+ * latency histogram of the device in sysfs. Stamps take 8 bytes per value
+ * the capacity holds. Enabling them resets the list.
+ *
+ * FLIFO_CMD_SET_TTL sets a time to live in microseconds, 0 to keep the values
+ * forever. Stamped values older than it are dropped without being read, the
+ * next time the list is read, written or polled, and counted in the expired
+ * attribute of the device.
+ */
+
+/* Operations of IORING_OP_URING_CMD, see struct flifo_uring_cmd */
+#define FLIFO_URING_CMD_PUSH	    0
+#define FLIFO_URING_CMD_POP	    1
 
 #define MODE_FIFO		    0
 #define MODE_LIFO		    1
+#define MODE_SHARED		    2
+#define MODE_PRIO		    3
+/*
+ * Every reader sees every value, each reader has its own cursor and the
+ * slowest one sets the free space. A file opened read only is a reader from
+ * the start, one opened read-write only joins on its first read, with the
+ * values still kept for the others, so writers don't hold the values back.
+ */
+#define MODE_BROADCAST		    4
+/*
+ * The list is split in one shard per CPU, writers fill the shard of their
+ * CPU and readers empty theirs before stealing from the others. Values keep
+ * their order within a shard only and reads may be short: they return as
+ * soon as some values were read. Batches are not supported in this mode.
+ */
+#define MODE_RELAXED		    5
+/*
+ * Each write is stored as one message and each read returns exactly one whole
+ * message, in FIFO or LIFO order. The value size is ignored. A read fails with
+ * EMSGSIZE, and leaves the message in the list, if its buffer is smaller than
+ * the next message, whose length FLIFO_CMD_PEEK_LEN gives without reading it.
+ * A message of n bytes takes FLIFO_MSG_HEADER_SIZE + n rounded up to
+ * FLIFO_MSG_HEADER_SIZE bytes of the capacity.
+ */
+#define MODE_MSG_FIFO		    6
+#define MODE_MSG_LIFO		    7
+
+/* Order of MODE_PRIO, values are compared as unsigned integers */
+#define PRIO_MIN_FIRST		    0
+#define PRIO_MAX_FIRST		    1
+
+/* Capacity of the list in bytes, always rounded up to a power of two */
+#define FLIFO_DEFAULT_CAPACITY	    64
+#define FLIFO_MIN_CAPACITY	    8
+#define FLIFO_MAX_CAPACITY	    (256UL << 20)
+
+/* Length stored in front of each message in MODE_MSG_FIFO and MODE_MSG_LIFO */
+#define FLIFO_MSG_HEADER_SIZE	    4
+
+#define FLIFO_SHM_CACHELINE_SIZE    64
+
+/* Maximum number of entries of a batch, same limit as readv/writev */
+#define FLIFO_MAX_BATCH		    1024
+
+/*
+ * One buffer of a batch. Each entry is pushed or popped as a whole, exactly
+ * like a write() or read() of count bytes, and the driver stores in result
+ * the number of bytes moved or a negative error code.
+ */
+struct flifo_batch_entry {
+	__u64 buf;
+	__u64 count;
+	__s64 result;
+};
+
+/*
+ * Argument of FLIFO_CMD_PUSH_BATCH and FLIFO_CMD_POP_BATCH: an array of
+ * nb_entries entries processed in order under a single lock of the list.
+ * Only the first entry may block, the batch stops at the first entry that
+ * can't be satisfied right away and the ioctl returns the number of entries
+ * fully processed.
+ */
+struct flifo_batch {
+	__u64 entries;
+	__u32 nb_entries;
+	__u32 reserved;
+};
+
+/*
+ * Argument of FLIFO_CMD_SET_EVENTFD. The eventfd is signaled each time the
+ * fill level of the list crosses the watermark, in bytes, upward or downward.
+ * The eventfd stays registered, even once the file that registered it is
+ * closed, until a negative fd unregisters it. The level is the one the
+ * driver sees: updates of the shared ring by userspace are not tracked and
+ * the RELAXED mode never signals.
+ */
+struct flifo_eventfd {
+	__s32 fd;
+	__u32 reserved;
+	__u64 watermark;
+};
+
+/*
+ * Command of an IORING_OP_URING_CMD submission, it fits in the command area
+ * of a regular 64 bytes SQE. FLIFO_URING_CMD_PUSH and FLIFO_URING_CMD_POP
+ * behave exactly like a write() or read() of count bytes at buf and complete
+ * with the same result.
+ */
+struct flifo_uring_cmd {
+	__u64 buf;
+	__u64 count;
+};
+
+/*
+ * Header of the shared ring, mapped at offset 0 of the device in MODE_SHARED.
+ * The ring data starts data_offset bytes after the header.
+ *
+ * head and tail are free running byte counters: the ring holds head - tail
+ * bytes and the next byte to read is at tail & (capacity - 1). Only the
+ * producer moves head and only the consumer moves tail, each on its own cache
+ * line. A side about to sleep sets its *_waiting flag, the other side clears
+ * it and rings FLIFO_CMD_DOORBELL after its next update.
+ */
+struct flifo_shm_header {
+	/* Layout of the ring, written by the driver on reset */
+	__u32 capacity;
+	__u32 value_size;
+	__u32 data_offset;
+
+	/* Producer side */
+	__u32 head __attribute__((aligned(FLIFO_SHM_CACHELINE_SIZE)));
+	__u32 producer_waiting;
+
+	/* Consumer side */
+	__u32 tail __attribute__((aligned(FLIFO_SHM_CACHELINE_SIZE)));
+	__u32 consumer_waiting;
+} __attribute__((aligned(FLIFO_SHM_CACHELINE_SIZE)));
 
 #endif /* FLIFO_H */
@@ -0,0 +1,810 @@
+#include <linux/cpumask.h> /* Needed for nr_cpu_ids */
+#include <linux/eventfd.h> /* Needed for eventfd_ctx_put */
+#include <linux/kernel.h>
+#include <linux/log2.h> /* Needed for roundup_pow_of_two */
+#include <linux/minmax.h> /* Needed for min_t and swap */
+#include <linux/mm.h> /* Needed for PAGE_SIZE */
+#include <linux/percpu.h> /* Needed for the statistics */
+#include <linux/slab.h> /* Needed for kcalloc */
+#include <linux/string.h>
+#include <linux/timekeeping.h> /* Needed for ktime_get_ns */
+#include <linux/vmalloc.h> /* Needed for vmalloc_user */
+
+#include "flifo_core.h"
+
+/*
+ * Ring layout
+ *
+ * FIFO: values are stored in arrival order. The oldest byte is at
+ * next_in - value_count and new values are appended at next_in.
+ *
+ * LIFO: the stack grows downward. next_in is the position of the most recent
+ * value and the stack spans [next_in, next_in + value_count). A write
+ * reverses the order of its values once so that a read is a plain copy
+ * starting at next_in, exactly like in FIFO mode.
+ *
+ * SHARED: FIFO order, but the positions are the free running head and tail
+ * counters of the shared header, so userspace can map the ring and push or
+ * pop values without a system call. The driver acts as one more producer or
+ * consumer of the same SPSC protocol, see struct flifo_shm_header.
+ *
+ * BROADCAST: FIFO order, but reading is not destructive. Each reader has a
+ * cursor that follows the free running head of the list, its next byte is
+ * at cursor & mask. value_count is what the slowest reader has yet to read.
+ *
+ * RELAXED: the list is split in nr_shards FIFO rings of shard_capacity bytes,
+ * each one wrapping with `& (shard_capacity - 1)` inside its own region.
+ *
+ * MSG_FIFO and MSG_LIFO: laid out like FIFO and LIFO, but each value is a
+ * message: a u32 length followed by the payload, padded so that the next
+ * header is aligned on FLIFO_MSG_HEADER_SIZE. A header never straddles the
+ * end of the ring, the payload may wrap around it.
+ *
+ * PRIO: the values form a binary heap in [0, value_count), the root at 0 is
+ * the smallest (or largest) value. Positions never wrap.
+ *
+ * The capacity is a power of two so positions wrap with `& mask`. Since it is
+ * also a multiple of every valid value size and the list is reset whenever
+ * the value size changes, a value never straddles the end of the ring.
+ */
+
+/**
+ * @brief Copies bytes from the ring to the buffers of an iterator.
+ * The copy is done in at most two contiguous runs, the second one only
+ * when the data wraps around the end of the ring. The iterator takes care
+ * of spreading them over its segments.
+ *
+ * @param to    Destination iterator, advanced by the copy.
+ * @param pos   Position in the ring of the first byte to copy.
+ * @param count Number of bytes to copy.
+ *
+ * @return 0 on success, -EFAULT if a buffer of the iterator is invalid.
+ */
+static int ring_to_iter(struct flifo *q, struct iov_iter *to, size_t pos,
+			size_t count)
+{
+	const size_t first = min_t(size_t, count, q->capacity - pos);
+
+	if (copy_to_iter(q->values + pos, first, to) != first) {
+		return -EFAULT;
+	}
+	if (count > first &&
+	    copy_to_iter(q->values, count - first, to) != count - first) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/**
+ * @brief Copies bytes from the buffers of an iterator to the ring.
+ * The copy is done in at most two contiguous runs, the second one only
+ * when the data wraps around the end of the ring.
+ *
+ * @param pos   Position in the ring where the first byte is written.
+ * @param from  Source iterator, advanced by the copy.
+ * @param count Number of bytes to copy.
+ *
+ * @return 0 on success, -EFAULT if a buffer of the iterator is invalid.
+ */
+static int ring_from_iter(struct flifo *q, size_t pos, struct iov_iter *from,
+			  size_t count)
+{
+	const size_t first = min_t(size_t, count, q->capacity - pos);
+
+	if (copy_from_iter(q->values + pos, first, from) != first) {
+		return -EFAULT;
+	}
+	if (count > first &&
+	    copy_from_iter(q->values, count - first, from) != count - first) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/**
+ * @brief Swaps two values of the ring with word-sized accesses picked from
+ * the value size.
+ *
+ * @param a    Position in the ring of the first value.
+ * @param b    Position in the ring of the second value.
+ * @param size Size of a value.
+ */
+static void swap_values(struct flifo *q, size_t a, size_t b, size_t size)
+{
+	switch (size) {
+	case 1:
+		swap(q->values[a], q->values[b]);
+		break;
+	case 2:
+		swap(*(u16 *)(q->values + a), *(u16 *)(q->values + b));
+		break;
+	case 4:
+		swap(*(u32 *)(q->values + a), *(u32 *)(q->values + b));
+		break;
+	case 8:
+		swap(*(u64 *)(q->values + a), *(u64 *)(q->values + b));
+		break;
+	}
+}
+
+/**
+ * @brief Reverses the order of the values stored in a region of the ring.
+ * Whole values are swapped, their bytes are kept in place.
+ *
+ * @param pos   Position in the ring of the first value.
+ * @param count Size of the region in bytes.
+ * @param size  Size of a value.
+ */
+static void reverse_values(struct flifo *q, size_t pos, size_t count,
+			   size_t size)
+{
+	size_t low = pos;
+	size_t high = (pos + count - size) & q->mask;
+
+	for (size_t i = 0; i < count / size / 2; ++i) {
+		swap_values(q, low, high, size);
+		low = (low + size) & q->mask;
+		high = (high - size) & q->mask;
+	}
+}
+
+/**
+ * @brief Returns the value stored at a position of the ring as an unsigned
+ * integer.
+ *
+ * @param pos  Position in the ring of the value.
+ * @param size Size of a value.
+ */
+static u64 value_at(struct flifo *q, size_t pos, size_t size)
+{
+	switch (size) {
+	case 1:
+		return q->values[pos];
+	case 2:
+		return *(u16 *)(q->values + pos);
+	case 4:
+		return *(u32 *)(q->values + pos);
+	default:
+		return *(u64 *)(q->values + pos);
+	}
+}
+
+/**
+ * @brief Tells if the value at position a must be read before the one at
+ * position b in PRIO mode.
+ */
+static bool heap_before(struct flifo *q, size_t a, size_t b, size_t size)
+{
+	const u64 value_a = value_at(q, a, size);
+	const u64 value_b = value_at(q, b, size);
+
+	if (q->prio_order == PRIO_MAX_FIRST) {
+		return value_a > value_b;
+	}
+	return value_a < value_b;
+}
+
+/**
+ * @brief Moves the value at index i of the heap up until its parent comes
+ * before it.
+ *
+ * @param i    Index of the value, in values.
+ * @param size Size of a value.
+ */
+static void heap_sift_up(struct flifo *q, size_t i, size_t size)
+{
+	size_t parent;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!heap_before(q, i * size, parent * size, size)) {
+			break;
+		}
+		swap_values(q, i * size, parent * size, size);
+		i = parent;
+	}
+}
+
+/**
+ * @brief Moves the value at index i of the heap down until it comes before
+ * its children.
+ *
+ * @param i    Index of the value, in values.
+ * @param n    Number of values in the heap.
+ * @param size Size of a value.
+ */
+static void heap_sift_down(struct flifo *q, size_t i, size_t n, size_t size)
+{
+	size_t first;
+	size_t child;
+
+	for (;;) {
+		first = i;
+		child = 2 * i + 1;
+		if (child < n &&
+		    heap_before(q, child * size, first * size, size)) {
+			first = child;
+		}
+		child++;
+		if (child < n &&
+		    heap_before(q, child * size, first * size, size)) {
+			first = child;
+		}
+		if (first == i) {
+			break;
+		}
+		swap_values(q, i * size, first * size, size);
+		i = first;
+	}
+}
+
+/**
+ * @brief Rebuilds the heap in place, needed when the order changes.
+ */
+void flifo_heap_build(struct flifo *q)
+{
+	const size_t size = q->value_size;
+	const size_t n = q->value_count / size;
+
+	for (size_t i = n / 2; i-- > 0;) {
+		heap_sift_down(q, i, n, size);
+	}
+}
+
+/**
+ * @brief Pops count bytes of values from the heap to the userspace buffers.
+ * The values are popped like in a heapsort: each root is swapped with the
+ * last value of the heap, which shrinks by one, so the popped values end up
+ * right after the heap in reverse order. Reversing that region lets us copy
+ * all the values at once, and put them back if the copy fails.
+ *
+ * @param to    the iterator over the userspace buffers receiving the values
+ * @param count the number of bytes to read
+ *
+ * @return 0 on success, -EFAULT if a userspace buffer is invalid.
+ */
+static int heap_pop_to_iter(struct flifo *q, struct iov_iter *to, size_t count)
+{
+	const size_t size = q->value_size;
+	const size_t n = q->value_count / size;
+	const size_t remaining = n - count / size;
+	int ret;
+
+	for (size_t last = n - 1; last + 1 > remaining; --last) {
+		swap_values(q, 0, last * size, size);
+		heap_sift_down(q, 0, last, size);
+	}
+	reverse_values(q, remaining * size, count, size);
+
+	ret = ring_to_iter(q, to, remaining * size, count);
+	if (ret) {
+		// Nothing was consumed, insert the values back
+		for (size_t i = remaining; i < n; ++i) {
+			heap_sift_up(q, i, size);
+		}
+		return ret;
+	}
+	q->value_count -= count;
+	return 0;
+}
+
+/**
+ * @brief Pushes count bytes of values from the userspace buffers to the
+ * heap. The values are copied after the heap at once, then inserted one by
+ * one.
+ *
+ * @param from  the iterator over the userspace buffers containing the values
+ * @param count the number of bytes to write
+ *
+ * @return 0 on success, -EFAULT if a userspace buffer is invalid.
+ */
+static int heap_push_from_iter(struct flifo *q, struct iov_iter *from,
+			       size_t count)
+{
+	const size_t size = q->value_size;
+	const size_t n = q->value_count / size;
+	int ret;
+
+	ret = ring_from_iter(q, q->value_count, from, count);
+	if (ret) {
+		return ret;
+	}
+	for (size_t i = n; i < n + count / size; ++i) {
+		heap_sift_up(q, i, size);
+	}
+	q->value_count += count;
+	return 0;
+}
+
+/**
+ * @brief Reads the next message of the list to the userspace buffers.
+ *
+ * @param to    the iterator over the userspace buffers receiving the message
+ * @param count the size of the userspace buffers
+ *
+ * @return Length of the message on success, -EMSGSIZE if it doesn't fit in
+ * count bytes or -EFAULT if a userspace buffer is invalid. On failure the
+ * message stays in the list.
+ */
+static ssize_t msg_to_iter(struct flifo *q, struct iov_iter *to, size_t count)
+{
+	const size_t out = msg_out(q);
+	const u32 len = *(u32 *)(q->values + out);
+	int ret;
+
+	if (len > count) {
+		return -EMSGSIZE;
+	}
+	ret = ring_to_iter(q, to, (out + FLIFO_MSG_HEADER_SIZE) & q->mask, len);
+	if (ret) {
+		return ret;
+	}
+	q->value_count -= msg_size(len);
+	if (q->mode == MODE_MSG_LIFO) {
+		q->next_in = (q->next_in + msg_size(len)) & q->mask;
+	}
+	return len;
+}
+
+/**
+ * @brief Writes one message of count bytes from the userspace buffers to
+ * the list. In LIFO order the message is stored below the current top, its
+ * bytes are kept in order.
+ *
+ * @param from  the iterator over the userspace buffers containing the message
+ * @param count the length of the message
+ *
+ * @return 0 on success, -EFAULT if a userspace buffer is invalid.
+ */
+static int msg_from_iter(struct flifo *q, struct iov_iter *from, size_t count)
+{
+	const size_t size = msg_size(count);
+	size_t in = q->next_in;
+	int ret;
+
+	if (q->mode == MODE_MSG_LIFO) {
+		in = (q->next_in - size) & q->mask;
+	}
+	ret = ring_from_iter(q, (in + FLIFO_MSG_HEADER_SIZE) & q->mask, from,
+			     count);
+	if (ret) {
+		return ret;
+	}
+	// The header is written last so a failed copy leaves no trace
+	*(u32 *)(q->values + in) = count;
+	q->next_in = q->mode == MODE_MSG_LIFO ? in : (in + size) & q->mask;
+	q->value_count += size;
+	return 0;
+}
+
+/**
+ * @brief Recomputes the number of bytes kept in broadcast mode, those the
+ * slowest reader has yet to read. Without readers nothing is kept.
+ *
+ * @return true if some space was freed.
+ */
+bool flifo_broadcast_trim(struct flifo *q)
+{
+	struct flifo_file *reader;
+	size_t kept = 0;
+	bool freed;
+
+	list_for_each_entry(reader, &q->readers, node) {
+		kept = max_t(size_t, kept, q->head - reader->cursor);
+	}
+	freed = kept < q->value_count;
+	WRITE_ONCE(q->value_count, kept);
+	return freed;
+}
+
+/**
+ * @brief Stamps the values just written in a region of the ring.
+ *
+ * @param pos   Position in the ring of the first value.
+ * @param count Size of the region in bytes.
+ * @param size  Size of a value.
+ */
+static void stamp_values(struct flifo *q, size_t pos, size_t count,
+			 size_t size)
+{
+	const u64 now = ktime_get_ns();
+
+	for (size_t i = 0; i < count; i += size) {
+		q->stamps[stamp_index(q, pos + i)] = now;
+	}
+}
+
+/**
+ * @brief Accounts the time spent in the list by the values of a region of
+ * the ring that were just read.
+ *
+ * @param pos   Position in the ring of the first value.
+ * @param count Size of the region in bytes.
+ * @param size  Size of a value.
+ */
+static void account_latency(struct flifo *q, size_t pos, size_t count,
+			    size_t size)
+{
+	const u64 now = ktime_get_ns();
+	u64 elapsed;
+
+	for (size_t i = 0; i < count; i += size) {
+		elapsed = now - q->stamps[stamp_index(q, pos + i)];
+		q->latency[min_t(unsigned int,
+				 elapsed ? ilog2(elapsed) : 0,
+				 LATENCY_BUCKETS - 1)]++;
+	}
+}
+
+/**
+ * @brief  reads values from our list to the userspace buffers depending on
+ * the mode
+ * This function updates next_in and value_count, or the cursor of the
+ * reader in broadcast mode
+ * @param file  the open file reading the values
+ * @param to    the iterator over the userspace buffers receiving the values
+ * @param count the number of bytes to read
+ *
+ * @return Number of bytes read, count except in message mode, -EFAULT if a
+ * userspace buffer is invalid, -EMSGSIZE if the next message doesn't fit in
+ * count bytes.
+ */
+ssize_t flifo_read_from_list(struct flifo_file *file, struct iov_iter *to,
+			     size_t count)
+{
+	struct flifo *q = file->q;
+	size_t out;
+	__u32 tail;
+	int ret;
+
+	// In all modes the values to read start at `out`, see the ring layout
+	switch (q->mode) {
+	case MODE_FIFO:
+		out = (q->next_in - q->value_count) & q->mask;
+		break;
+	case MODE_LIFO:
+		out = q->next_in;
+		break;
+	case MODE_SHARED:
+		// We are the consumer, the tail is ours
+		tail = q->shm->tail;
+		ret = ring_to_iter(q, to, tail & q->mask, count);
+		if (ret) {
+			return ret;
+		}
+		// Publish the freed space once we are done reading it
+		smp_store_release(&q->shm->tail, tail + count);
+		WRITE_ONCE(q->shm->producer_waiting, 0);
+		return count;
+	case MODE_PRIO:
+		ret = heap_pop_to_iter(q, to, count);
+		return ret ? ret : count;
+	case MODE_BROADCAST:
+		// Only this reader moves on, the values stay for the others
+		ret = ring_to_iter(q, to, file->cursor & q->mask, count);
+		if (ret) {
+			return ret;
+		}
+		WRITE_ONCE(file->cursor, file->cursor + count);
+		flifo_broadcast_trim(q);
+		return count;
+	case MODE_MSG_FIFO:
+	case MODE_MSG_LIFO:
+		return msg_to_iter(q, to, count);
+	default:
+		return -EINVAL;
+	}
+
+	// Copy straight from the ring to the user space buffer
+	ret = ring_to_iter(q, to, out, count);
+	if (ret) {
+		return ret;
+	}
+
+	if (is_stamped(q)) {
+		account_latency(q, out, count, q->value_size);
+	}
+	// Update the next_in and value_count only once the copy succeeded
+	q->value_count -= count;
+	if (q->mode == MODE_LIFO) {
+		q->next_in = (q->next_in + count) & q->mask;
+	}
+	return count;
+}
+
+/**
+ * @brief  writes the values from the userspace buffers to our list depending
+ * on the mode
+ * This function updates next_in and value_count
+ * @param from  the iterator over the userspace buffers containing the values
+ * @param count the number of bytes to write
+ * @param size  the size of the values to write
+ *
+ * @return 0 on success, -EFAULT if a userspace buffer is invalid.
+ */
+int flifo_write_to_list(struct flifo *q, struct iov_iter *from, size_t count,
+			size_t size)
+{
+	size_t in;
+	__u32 head;
+	int ret;
+
+	DBG("Count: %lu\n", count);
+	DBG("Size: %lu\n", size);
+	DBG("Nb_values: %lu\n", count / size);
+	switch (q->mode) {
+	case MODE_FIFO:
+	case MODE_BROADCAST:
+		in = q->next_in;
+		break;
+	case MODE_LIFO:
+		// The stack grows downward, make room below the current top
+		in = (q->next_in - count) & q->mask;
+		break;
+	case MODE_SHARED:
+		// We are the producer, the head is ours
+		head = q->shm->head;
+		ret = ring_from_iter(q, head & q->mask, from, count);
+		if (ret) {
+			return ret;
+		}
+		// Publish the values once they are fully written
+		smp_store_release(&q->shm->head, head + count);
+		WRITE_ONCE(q->shm->consumer_waiting, 0);
+		return 0;
+	case MODE_PRIO:
+		return heap_push_from_iter(q, from, count);
+	case MODE_MSG_FIFO:
+	case MODE_MSG_LIFO:
+		return msg_from_iter(q, from, count);
+	default:
+		return -EINVAL;
+	}
+
+	ret = ring_from_iter(q, in, from, count);
+	if (ret) {
+		return ret;
+	}
+
+	if (q->mode == MODE_LIFO) {
+		// Store the values in reverse order so that when we read them
+		// back starting from the top we get the last one first.
+		// eg: size = 2 and user sends us 0x0001 0x0002
+		// we store them as 0x0002 0x0001
+		reverse_values(q, in, count, size);
+		q->next_in = in;
+	} else {
+		q->next_in = (q->next_in + count) & q->mask;
+	}
+	if (is_stamped(q)) {
+		stamp_values(q, in, count, size);
+	}
+	q->value_count += count;
+	if (q->mode == MODE_BROADCAST) {
+		// Publish the values to every reader
+		WRITE_ONCE(q->head, q->head + count);
+		flifo_broadcast_trim(q);
+	}
+	return 0;
+}
+
+/**
+ * @brief Resets the list 
+ * 
+ */
+void flifo_reset_list(struct flifo *q)
+{
+	struct flifo_file *reader;
+
+	q->next_in = 0;
+	q->value_count = 0;
+	q->head = 0;
+	list_for_each_entry(reader, &q->readers, node) {
+		reader->cursor = 0;
+	}
+
+	// One shard per CPU, as long as each one can hold a few values
+	q->nr_shards = min_t(size_t, q->max_shards,
+			     q->capacity / FLIFO_MIN_CAPACITY);
+	q->shard_capacity = q->capacity / q->nr_shards;
+	for (unsigned int i = 0; i < q->max_shards; ++i) {
+		q->shards[i].start = i * q->shard_capacity;
+		q->shards[i].out = 0;
+		q->shards[i].count = 0;
+	}
+
+	// Publish the layout of the ring for the userspace mappings
+	q->shm->capacity = q->capacity;
+	q->shm->value_size = q->value_size;
+	q->shm->data_offset = PAGE_SIZE;
+	WRITE_ONCE(q->shm->head, 0);
+	WRITE_ONCE(q->shm->tail, 0);
+	WRITE_ONCE(q->shm->producer_waiting, 0);
+	WRITE_ONCE(q->shm->consumer_waiting, 0);
+}
+
+/**
+ * @brief Replaces the storage of the list with a new one. The requested
+ * capacity is rounded up to the next power of two and the list is reset.
+ *
+ * @param new_capacity Requested capacity in bytes.
+ *
+ * The storage holds the shared header in its first page and the values right
+ * after it, allocated with vmalloc_user so it can be mapped to userspace.
+ * The stamps follow the capacity when timestamps are enabled.
+ *
+ * @return 0 on success, -EINVAL if the capacity is out of bounds, -ENOMEM if
+ * the storage could not be allocated. On failure the list is left untouched.
+ */
+int flifo_set_capacity(struct flifo *q, unsigned long new_capacity)
+{
+	struct flifo_shm_header *new_shm;
+	u64 *new_stamps = NULL;
+
+	if (new_capacity < FLIFO_MIN_CAPACITY ||
+	    new_capacity > FLIFO_MAX_CAPACITY) {
+		return -EINVAL;
+	}
+	new_capacity = roundup_pow_of_two(new_capacity);
+
+	new_shm = vmalloc_user(PAGE_SIZE + new_capacity);
+	if (!new_shm) {
+		return -ENOMEM;
+	}
+	if (q->stamps) {
+		new_stamps = kvcalloc(new_capacity / q->value_size,
+				      sizeof(u64), GFP_KERNEL);
+		if (!new_stamps) {
+			vfree(new_shm);
+			return -ENOMEM;
+		}
+		kvfree(q->stamps);
+		q->stamps = new_stamps;
+	}
+	vfree(q->shm);
+	q->shm = new_shm;
+	q->values = (uint8_t *)new_shm + PAGE_SIZE;
+	q->capacity = new_capacity;
+	q->mask = new_capacity - 1;
+	flifo_reset_list(q);
+	return 0;
+}
+
+/**
+ * @brief Enables or disables the timestamps of the list. Enabling them
+ * resets the list, since the values already stored have no stamp, and the
+ * latency histogram.
+ *
+ * @param enable
+ *
+ * @return 0 on success, -ENOMEM if the stamps could not be allocated.
+ */
+int flifo_set_timestamps(struct flifo *q, bool enable)
+{
+	if (!enable) {
+		kvfree(q->stamps);
+		q->stamps = NULL;
+		return 0;
+	}
+	if (!q->stamps) {
+		q->stamps = kvcalloc(q->capacity / q->value_size, sizeof(u64),
+				     GFP_KERNEL);
+		if (!q->stamps) {
+			return -ENOMEM;
+		}
+	}
+	q->expired = 0;
+	memset(q->latency, 0, sizeof(q->latency));
+	flifo_reset_list(q);
+	return 0;
+}
+
+/**
+ * @brief Changes the size of the values of the list, the caller resets it.
+ * The stamps, one per value, are reallocated when timestamps are enabled.
+ *
+ * @param size New value size, 1, 2, 4 or 8.
+ *
+ * @return 0 on success, -ENOMEM if the stamps could not be allocated. On
+ * failure the list is left untouched.
+ */
+int flifo_set_value_size(struct flifo *q, size_t size)
+{
+	u64 *new_stamps;
+
+	if (q->stamps && size != q->value_size) {
+		new_stamps = kvcalloc(q->capacity / size, sizeof(u64),
+				      GFP_KERNEL);
+		if (!new_stamps) {
+			return -ENOMEM;
+		}
+		kvfree(q->stamps);
+		q->stamps = new_stamps;
+	}
+	q->value_size = size;
+	return 0;
+}
+
+/**
+ * @brief Initializes a list in FIFO mode with 1 byte values.
+ *
+ * @param q        List to initialize.
+ * @param capacity Requested capacity in bytes.
+ *
+ * @return 0 on success, -ENOMEM if the statistics or the shards could not be
+ * allocated or a negative error code from flifo_set_capacity otherwise.
+ */
+int flifo_init_queue(struct flifo *q, unsigned long capacity)
+{
+	int ret;
+
+	mutex_init(&q->lock);
+	mutex_init(&q->map_lock);
+	init_waitqueue_head(&q->read_wq);
+	init_waitqueue_head(&q->write_wq);
+	INIT_LIST_HEAD(&q->readers);
+	q->next_reader_id = 0;
+	q->shm = NULL;
+	q->value_size = 1;
+	q->mode = MODE_FIFO;
+	q->prio_order = PRIO_MIN_FIRST;
+	q->nb_mappings = 0;
+	q->eventfd = NULL;
+	q->watermark = 0;
+	q->stamps = NULL;
+	q->ttl = 0;
+	q->expired = 0;
+	memset(q->latency, 0, sizeof(q->latency));
+	q->high_water = 0;
+	q->mode_switches = 0;
+
+	q->stats = alloc_percpu(struct flifo_stats);
+	if (!q->stats) {
+		return -ENOMEM;
+	}
+
+	q->max_shards = roundup_pow_of_two(nr_cpu_ids);
+	q->shards = kcalloc(q->max_shards, sizeof(*q->shards), GFP_KERNEL);
+	if (!q->shards) {
+		ret = -ENOMEM;
+		goto free_stats;
+	}
+	for (unsigned int i = 0; i < q->max_shards; ++i) {
+		mutex_init(&q->shards[i].lock);
+	}
+
+	ret = flifo_set_capacity(q, capacity);
+	if (ret) {
+		kfree(q->shards);
+		q->shards = NULL;
+		goto free_stats;
+	}
+	return 0;
+
+free_stats:
+	free_percpu(q->stats);
+	q->stats = NULL;
+	return ret;
+}
+
+/**
+ * @brief Releases the storage of a list, its stamps, its statistics and its
+ * eventfd.
+ *
+ * @param q
+ */
+void flifo_destroy_queue(struct flifo *q)
+{
+	vfree(q->shm);
+	q->shm = NULL;
+	kfree(q->shards);
+	q->shards = NULL;
+	kvfree(q->stamps);
+	q->stamps = NULL;
+	free_percpu(q->stats);
+	q->stats = NULL;
+	if (q->eventfd) {
+		eventfd_ctx_put(q->eventfd);
+		q->eventfd = NULL;
+	}
+}
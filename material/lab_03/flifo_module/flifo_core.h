@@ -0,0 +1,329 @@
+#ifndef FLIFO_CORE_H
+#define FLIFO_CORE_H
+
+/*
+ * Data path of the flifo lists: the storage of a list and how values are
+ * written to it, read from it and reset, in every mode but RELAXED. It knows
+ * nothing of the device, the locking or the waiting, which are up to the
+ * caller, so the KUnit suite can drive a list directly.
+ *
+ * Unless stated otherwise the functions expect the lock of the list held.
+ */
+
+#include <linux/cache.h> /* Needed for ____cacheline_aligned_in_smp */
+#include <linux/compiler.h> /* Needed for READ_ONCE */
+#include <linux/list.h> /* Needed for the readers of a list */
+#include <linux/math.h> /* Needed for round_up */
+#include <linux/mutex.h> /* Needed for mutexes */
+#include <linux/printk.h> /* Needed for DBG */
+#include <linux/types.h>
+#include <linux/uio.h> /* Needed for iov_iter */
+#include <linux/wait.h> /* Needed for wait queues */
+#include <asm/barrier.h> /* Needed for smp_load_acquire */
+
+#include "flifo.h"
+
+struct eventfd_ctx;
+
+#define DEBUGGING 0
+
+// Define DBG to print only if DEBUGGING is set
+#if DEBUGGING
+#define DBG(fmt, ...) pr_info(fmt, ##__VA_ARGS__)
+#else
+#define DBG(fmt, ...)
+#endif
+
+// Buckets of the latency histogram, bucket i counts the values read after
+// [2^i, 2^(i+1)) nanoseconds in the list, the first one also counts 0 and
+// the last one everything above
+#define LATENCY_BUCKETS 32
+
+/**
+ * struct flifo_shard - A part of a list in RELAXED mode, FIFO ordered.
+ * @lock:  Protects the shard. The configuration of the list only changes
+ *	   with every shard lock held, so holding one is enough to read it.
+ * @start: Position in the list of the first byte of the shard.
+ * @out:   Position of the oldest value, relative to start.
+ * @count: Number of bytes in the shard.
+ */
+struct flifo_shard {
+	struct mutex lock;
+	size_t start;
+	size_t out;
+	size_t count;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * struct flifo_stats - Counters of a list, per CPU so that the relaxed mode
+ * doesn't make the CPUs fight over them.
+ * @pushes:	 Successful writes, or pushed entries of a batch.
+ * @pops:	 Successful reads, or popped entries of a batch.
+ * @bytes_in:	 Bytes written.
+ * @bytes_out:	 Bytes read.
+ * @rejected:	 Writes that failed because the list was too full or the
+ *		 request invalid.
+ * @short_reads: Reads that returned fewer bytes than asked for, in relaxed or
+ *		 message mode.
+ */
+struct flifo_stats {
+	u64 pushes;
+	u64 pops;
+	u64 bytes_in;
+	u64 bytes_out;
+	u64 rejected;
+	u64 short_reads;
+};
+
+/**
+ * struct flifo - One list and its configuration.
+ * @lock:	 Protects the list and its configuration. In RELAXED mode the
+ *		 values are protected by the shard locks instead.
+ * @map_lock:	 Protects nb_mappings. Never held while touching userspace
+ *		 memory so it can be taken from the mmap callbacks, which run
+ *		 with the mmap lock held.
+ * @read_wq:	 Readers waiting for values.
+ * @write_wq:	 Writers waiting for space.
+ * @shm:	 Header of the shared ring, the values follow it at PAGE_SIZE.
+ * @values:	 List of values, page aligned so whole values can be accessed
+ *		 as words.
+ * @capacity:	 Size of the list in bytes, a power of two.
+ * @mask:	 capacity - 1, used to wrap positions in the list.
+ * @value_size:	 Size of the integer value.
+ * @value_count: Number of bytes in the list, message headers included.
+ * @next_in:	 Next position to write in the list.
+ * @head:	 Number of bytes written since the reset in BROADCAST mode,
+ *		 wraps around.
+ * @readers:	 Open files of the list that can read, see struct flifo_file.
+ * @next_reader_id: Identifier of the next reader.
+ * @mode:	 Mode of the list (FIFO, LIFO, SHARED, PRIO, BROADCAST,
+ *		 RELAXED, MSG_FIFO or MSG_LIFO).
+ * @prio_order:	 Which values are read first in PRIO mode.
+ * @shards:	 Shards of the list in RELAXED mode, max_shards of them.
+ * @max_shards:	 Number of CPUs rounded up to a power of two.
+ * @nr_shards:	 Number of shards in use, fewer than max_shards if the
+ *		 capacity is too small to give each one FLIFO_MIN_CAPACITY.
+ * @shard_capacity: Size of a shard in bytes, a power of two.
+ * @nb_mappings: Number of userspace mappings of the shared ring.
+ * @eventfd:	 Signaled when the fill level crosses the watermark, if any.
+ * @watermark:	 Fill level in bytes that triggers the eventfd.
+ * @stamps:	 Time at which each value was written, one per value indexed
+ *		 by its position, NULL unless timestamps are enabled. Only used
+ *		 in FIFO and LIFO modes.
+ * @ttl:	 Stamped values older than this many nanoseconds are dropped, 0
+ *		 to keep them.
+ * @expired:	 Number of values dropped because of the ttl.
+ * @latency:	 Histogram of the time the stamped values spent in the list.
+ * @stats:	 Counters of the list, see struct flifo_stats.
+ * @high_water:	 Highest fill level reached, in bytes. Not tracked in
+ *		 RELAXED mode.
+ * @mode_switches: Number of successful FLIFO_CMD_CHANGE_MODE.
+ * @is_private:	 The list belongs to a single open file and is freed with it.
+ */
+struct flifo {
+	struct mutex lock;
+	struct mutex map_lock;
+	wait_queue_head_t read_wq;
+	wait_queue_head_t write_wq;
+	struct flifo_shm_header *shm;
+	uint8_t *values;
+	size_t capacity;
+	size_t mask;
+	size_t value_size;
+	size_t value_count;
+	size_t next_in;
+	unsigned long head;
+	struct list_head readers;
+	unsigned int next_reader_id;
+	int mode;
+	int prio_order;
+	struct flifo_shard *shards;
+	unsigned int max_shards;
+	unsigned int nr_shards;
+	size_t shard_capacity;
+	int nb_mappings;
+	struct eventfd_ctx *eventfd;
+	size_t watermark;
+	u64 *stamps;
+	u64 ttl;
+	u64 expired;
+	u64 latency[LATENCY_BUCKETS];
+	struct flifo_stats __percpu *stats;
+	size_t high_water;
+	unsigned long mode_switches;
+	bool is_private;
+};
+
+/**
+ * struct flifo_file - An open file of a list.
+ * @q:	    The list the file gives access to.
+ * @node:   Entry in the readers of the list, once the file is a reader.
+ * @cursor: Number of bytes this reader read since the reset in BROADCAST
+ *	    mode, compared to the head of the list.
+ * @id:	    Identifier of the reader, reported in sysfs.
+ * @pid:    Process that opened the file, reported in sysfs.
+ */
+struct flifo_file {
+	struct flifo *q;
+	struct list_head node;
+	unsigned long cursor;
+	unsigned int id;
+	pid_t pid;
+};
+
+static inline bool is_msg_mode(int mode)
+{
+	return mode == MODE_MSG_FIFO || mode == MODE_MSG_LIFO;
+}
+
+/**
+ * @brief Returns the number of bytes a message takes in the list, its header
+ * and padding included.
+ *
+ * @param len Length of the message.
+ */
+static inline size_t msg_size(size_t len)
+{
+	return FLIFO_MSG_HEADER_SIZE + round_up(len, FLIFO_MSG_HEADER_SIZE);
+}
+
+/**
+ * @brief Returns the position in the ring of the header of the next message
+ * to read, the list must not be empty.
+ */
+static inline size_t msg_out(struct flifo *q)
+{
+	if (q->mode == MODE_MSG_FIFO) {
+		return (q->next_in - q->value_count) & q->mask;
+	}
+	return q->next_in;
+}
+
+/**
+ * @brief Checks that a read or write of count bytes can ever be satisfied
+ * with the current configuration of the list.
+ *
+ * @param count Number of bytes of the request.
+ *
+ * @return 0 if the request is valid, -EINVAL otherwise.
+ */
+static inline int check_count(struct flifo *q, size_t count)
+{
+	if (count % q->value_size != 0 || count > q->capacity) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * @brief Same as check_count for a read. In message mode any buffer is
+ * valid, whether the next message fits is only known once it is there.
+ */
+static inline int check_read(struct flifo *q, size_t count)
+{
+	if (is_msg_mode(READ_ONCE(q->mode))) {
+		return 0;
+	}
+	return check_count(q, count);
+}
+
+/**
+ * @brief Same as check_count for a write. In message mode the message must
+ * fit in the list with its header.
+ */
+static inline int check_write(struct flifo *q, size_t count)
+{
+	if (is_msg_mode(READ_ONCE(q->mode))) {
+		return msg_size(count) > READ_ONCE(q->capacity) ? -EINVAL : 0;
+	}
+	return check_count(q, count);
+}
+
+/**
+ * @brief Returns the number of bytes the list must hold for a read of count
+ * bytes to proceed. In message mode that is any message.
+ */
+static inline size_t read_need(struct flifo *q, size_t count)
+{
+	if (is_msg_mode(READ_ONCE(q->mode))) {
+		return FLIFO_MSG_HEADER_SIZE;
+	}
+	return count;
+}
+
+/**
+ * @brief Returns the number of bytes a write of count bytes takes in the
+ * list.
+ */
+static inline size_t write_need(struct flifo *q, size_t count)
+{
+	if (is_msg_mode(READ_ONCE(q->mode))) {
+		return msg_size(count);
+	}
+	return count;
+}
+
+/**
+ * @brief Returns the number of bytes stored in the list, with the lock held
+ * since the ring of the shared mode is freed under it. In shared mode the
+ * acquire loads order the following accesses to the ring data after the
+ * update of the peer.
+ */
+static inline size_t list_fill(struct flifo *q)
+{
+	if (READ_ONCE(q->mode) == MODE_SHARED) {
+		return smp_load_acquire(&q->shm->head) -
+		       smp_load_acquire(&q->shm->tail);
+	}
+	return READ_ONCE(q->value_count);
+}
+
+/**
+ * @brief Returns the number of bytes a file can read, with the lock held. In
+ * broadcast mode each reader has its own view of the list, a file that is
+ * not a reader yet would join with the values kept for the others.
+ */
+static inline size_t reader_fill(struct flifo_file *file)
+{
+	struct flifo *q = file->q;
+
+	if (READ_ONCE(q->mode) == MODE_BROADCAST) {
+		if (list_empty(&file->node)) {
+			return q->value_count;
+		}
+		return READ_ONCE(q->head) - READ_ONCE(file->cursor);
+	}
+	return list_fill(q);
+}
+
+/**
+ * @brief Tells if the values of the list are stamped, with the lock held.
+ */
+static inline bool is_stamped(struct flifo *q)
+{
+	return q->stamps && (q->mode == MODE_FIFO || q->mode == MODE_LIFO);
+}
+
+/**
+ * @brief Returns the index of the stamp of the value at a position of the
+ * ring. Values are aligned on their size, which divides the capacity.
+ */
+static inline size_t stamp_index(struct flifo *q, size_t pos)
+{
+	return (pos & q->mask) / q->value_size;
+}
+
+int flifo_init_queue(struct flifo *q, unsigned long capacity);
+void flifo_destroy_queue(struct flifo *q);
+int flifo_set_capacity(struct flifo *q, unsigned long new_capacity);
+int flifo_set_timestamps(struct flifo *q, bool enable);
+int flifo_set_value_size(struct flifo *q, size_t size);
+void flifo_reset_list(struct flifo *q);
+int flifo_write_to_list(struct flifo *q, struct iov_iter *from, size_t count,
+			size_t size);
+ssize_t flifo_read_from_list(struct flifo_file *file, struct iov_iter *to,
+			     size_t count);
+void flifo_heap_build(struct flifo *q);
+bool flifo_broadcast_trim(struct flifo *q);
+
+#endif /* FLIFO_CORE_H */
@@ -0,0 +1,392 @@
+#include <kunit/test.h>
+#include <linux/math64.h> /* Needed for div64_u64 */
+#include <linux/timekeeping.h> /* Needed for ktime_get_ns */
+#include <linux/uio.h> /* Needed for iov_iter */
+
+#include "flifo_core.h"
+
+/*
+ * KUnit suite of the data path of the lists, see flifo_core.h. The lists are
+ * driven directly, without a device, so the suite runs under UML:
+ * ./kunit.sh /path/to/linux
+ *
+ * The flifo_bench cases don't check much, they report the number of values
+ * enqueued and dequeued per second for a few batch sizes.
+ */
+
+#define KUNIT_CAPACITY 4096
+#define BENCH_CAPACITY (64 * 1024)
+// Number of values moved by each benchmark case
+#define BENCH_VALUES (1 << 20)
+
+/**
+ * struct flifo_kunit - A list and a reader of it, the context of a case.
+ * @q:	  The list, initialized with KUNIT_CAPACITY bytes.
+ * @file: A reader of the list, not registered in its readers.
+ */
+struct flifo_kunit {
+	struct flifo q;
+	struct flifo_file file;
+};
+
+static const size_t value_sizes[] = { 1, 2, 4, 8 };
+
+static void value_size_desc(const size_t *size, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%zu byte values", *size);
+}
+
+KUNIT_ARRAY_PARAM(value_size, value_sizes, value_size_desc);
+
+/**
+ * struct flifo_bench_param - Configuration of a benchmark case.
+ * @mode:  MODE_FIFO or MODE_LIFO.
+ * @batch: Number of values per write and per read.
+ */
+struct flifo_bench_param {
+	int mode;
+	size_t batch;
+};
+
+static const struct flifo_bench_param bench_params[] = {
+	{ MODE_FIFO, 1 },   { MODE_FIFO, 16 },	{ MODE_FIFO, 256 },
+	{ MODE_FIFO, 4096 }, { MODE_LIFO, 1 },	{ MODE_LIFO, 16 },
+	{ MODE_LIFO, 256 }, { MODE_LIFO, 4096 },
+};
+
+static void bench_desc(const struct flifo_bench_param *param, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%s, batches of %zu values",
+		 param->mode == MODE_FIFO ? "fifo" : "lifo", param->batch);
+}
+
+KUNIT_ARRAY_PARAM(bench, bench_params, bench_desc);
+
+/**
+ * @brief Returns the i-th value of the sequence written by the cases,
+ * truncated to the value size. The values are spread so that a value out of
+ * place doesn't go unnoticed.
+ */
+static u64 pattern(size_t i, size_t size)
+{
+	const u64 value = (i + 1) * 0x9e3779b97f4a7c15ULL;
+
+	return size == 8 ? value : value & ((1ULL << (size * 8)) - 1);
+}
+
+static void put_value(void *buf, size_t i, size_t size, u64 value)
+{
+	switch (size) {
+	case 1:
+		((u8 *)buf)[i] = value;
+		break;
+	case 2:
+		((u16 *)buf)[i] = value;
+		break;
+	case 4:
+		((u32 *)buf)[i] = value;
+		break;
+	case 8:
+		((u64 *)buf)[i] = value;
+		break;
+	}
+}
+
+static u64 get_value(const void *buf, size_t i, size_t size)
+{
+	switch (size) {
+	case 1:
+		return ((const u8 *)buf)[i];
+	case 2:
+		return ((const u16 *)buf)[i];
+	case 4:
+		return ((const u32 *)buf)[i];
+	default:
+		return ((const u64 *)buf)[i];
+	}
+}
+
+/**
+ * @brief Fills a buffer with the values first to first + n - 1 of the
+ * sequence.
+ */
+static void fill_values(void *buf, size_t first, size_t n, size_t size)
+{
+	for (size_t i = 0; i < n; ++i) {
+		put_value(buf, i, size, pattern(first + i, size));
+	}
+}
+
+/**
+ * @brief Changes the mode and the value size of the list, which resets it
+ * like FLIFO_CMD_CHANGE_MODE and FLIFO_CMD_CHANGE_VALUE_SIZE do.
+ */
+static void configure(struct flifo *q, int mode, size_t size)
+{
+	q->mode = mode;
+	q->value_size = size;
+	flifo_reset_list(q);
+}
+
+/**
+ * @brief Writes count bytes of values from a kernel buffer to the list,
+ * which must have room for them.
+ *
+ * @return 0 on success or a negative error code from flifo_write_to_list.
+ */
+static int push(struct flifo *q, const void *buf, size_t count)
+{
+	struct kvec kvec = { .iov_base = (void *)buf, .iov_len = count };
+	struct iov_iter iter;
+
+	iov_iter_kvec(&iter, WRITE, &kvec, 1, count);
+	return flifo_write_to_list(q, &iter, count, q->value_size);
+}
+
+/**
+ * @brief Reads count bytes of values from the list to a kernel buffer, the
+ * list must hold them.
+ *
+ * @return Number of bytes read or a negative error code from
+ * flifo_read_from_list.
+ */
+static ssize_t pop(struct flifo_file *file, void *buf, size_t count)
+{
+	struct kvec kvec = { .iov_base = buf, .iov_len = count };
+	struct iov_iter iter;
+
+	iov_iter_kvec(&iter, READ, &kvec, 1, count);
+	return flifo_read_from_list(file, &iter, count);
+}
+
+static int flifo_kunit_init(struct kunit *test)
+{
+	struct flifo_kunit *ctx;
+	int ret;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	if (!ctx) {
+		return -ENOMEM;
+	}
+	ret = flifo_init_queue(&ctx->q, KUNIT_CAPACITY);
+	if (ret) {
+		return ret;
+	}
+	ctx->file.q = &ctx->q;
+	INIT_LIST_HEAD(&ctx->file.node);
+	test->priv = ctx;
+	return 0;
+}
+
+static void flifo_kunit_exit(struct kunit *test)
+{
+	struct flifo_kunit *ctx = test->priv;
+
+	flifo_destroy_queue(&ctx->q);
+}
+
+/**
+ * @brief Fills the list in FIFO mode from a position that makes the values
+ * wrap around the end of the ring, then reads them back in small chunks.
+ */
+static void flifo_test_fifo(struct kunit *test)
+{
+	struct flifo_kunit *ctx = test->priv;
+	const size_t size = *(const size_t *)test->param_value;
+	const size_t n = KUNIT_CAPACITY / size;
+	// Not a divisor of n, the last chunk is shorter
+	const size_t chunk = 3;
+	void *buf = kunit_kmalloc(test, KUNIT_CAPACITY, GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+	configure(&ctx->q, MODE_FIFO, size);
+
+	// Move the read position to a third of the ring
+	fill_values(buf, 0, n / 3, size);
+	KUNIT_ASSERT_EQ(test, push(&ctx->q, buf, n / 3 * size), 0);
+	KUNIT_ASSERT_EQ(test, pop(&ctx->file, buf, n / 3 * size),
+			(ssize_t)(n / 3 * size));
+	KUNIT_ASSERT_EQ(test, ctx->q.value_count, 0);
+
+	fill_values(buf, 0, n, size);
+	KUNIT_ASSERT_EQ(test, push(&ctx->q, buf, KUNIT_CAPACITY), 0);
+	KUNIT_EXPECT_EQ(test, ctx->q.value_count, KUNIT_CAPACITY);
+
+	memset(buf, 0, KUNIT_CAPACITY);
+	for (size_t i = 0; i < n; i += chunk) {
+		const size_t count = min(chunk, n - i) * size;
+
+		KUNIT_ASSERT_EQ(test, pop(&ctx->file, buf + i * size, count),
+				(ssize_t)count);
+	}
+	for (size_t i = 0; i < n; ++i) {
+		KUNIT_EXPECT_EQ_MSG(test, get_value(buf, i, size),
+				    pattern(i, size), "value %zu", i);
+	}
+	KUNIT_EXPECT_EQ(test, ctx->q.value_count, 0);
+}
+
+/**
+ * @brief Fills the list in LIFO mode with writes of increasing length, then
+ * reads it back one value at a time: the values come out in the reverse
+ * order of the whole sequence, not of each write.
+ */
+static void flifo_test_lifo(struct kunit *test)
+{
+	struct flifo_kunit *ctx = test->priv;
+	const size_t size = *(const size_t *)test->param_value;
+	const size_t n = KUNIT_CAPACITY / size;
+	void *buf = kunit_kmalloc(test, KUNIT_CAPACITY, GFP_KERNEL);
+	size_t written = 0;
+	u64 value;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+	configure(&ctx->q, MODE_LIFO, size);
+
+	for (size_t len = 1; written < n; ++len) {
+		len = min(len, n - written);
+		fill_values(buf, written, len, size);
+		KUNIT_ASSERT_EQ(test, push(&ctx->q, buf, len * size), 0);
+		written += len;
+	}
+	KUNIT_EXPECT_EQ(test, ctx->q.value_count, KUNIT_CAPACITY);
+
+	for (size_t i = n; i-- > 0;) {
+		KUNIT_ASSERT_EQ(test, pop(&ctx->file, &value, size),
+				(ssize_t)size);
+		KUNIT_EXPECT_EQ_MSG(test, get_value(&value, 0, size),
+				    pattern(i, size), "value %zu", i);
+	}
+	KUNIT_EXPECT_EQ(test, ctx->q.value_count, 0);
+}
+
+/**
+ * @brief Interleaves writes and reads in LIFO mode: a read takes the most
+ * recent values, whatever write they come from.
+ */
+static void flifo_test_lifo_interleaved(struct kunit *test)
+{
+	struct flifo_kunit *ctx = test->priv;
+	const size_t size = *(const size_t *)test->param_value;
+	u64 values[4];
+	u64 out[4];
+
+	configure(&ctx->q, MODE_LIFO, size);
+
+	// Push 0 1 2 3, pop 3 2
+	fill_values(values, 0, 4, size);
+	KUNIT_ASSERT_EQ(test, push(&ctx->q, values, 4 * size), 0);
+	KUNIT_ASSERT_EQ(test, pop(&ctx->file, out, 2 * size),
+			(ssize_t)(2 * size));
+	KUNIT_EXPECT_EQ(test, get_value(out, 0, size), pattern(3, size));
+	KUNIT_EXPECT_EQ(test, get_value(out, 1, size), pattern(2, size));
+
+	// Push 4 5, pop 5 4 1 0
+	fill_values(values, 4, 2, size);
+	KUNIT_ASSERT_EQ(test, push(&ctx->q, values, 2 * size), 0);
+	KUNIT_ASSERT_EQ(test, pop(&ctx->file, out, 4 * size),
+			(ssize_t)(4 * size));
+	KUNIT_EXPECT_EQ(test, get_value(out, 0, size), pattern(5, size));
+	KUNIT_EXPECT_EQ(test, get_value(out, 1, size), pattern(4, size));
+	KUNIT_EXPECT_EQ(test, get_value(out, 2, size), pattern(1, size));
+	KUNIT_EXPECT_EQ(test, get_value(out, 3, size), pattern(0, size));
+	KUNIT_EXPECT_EQ(test, ctx->q.value_count, 0);
+}
+
+/**
+ * @brief Checks that a reset drops the values and that the list starts over
+ * from the beginning of the ring.
+ */
+static void flifo_test_reset(struct kunit *test)
+{
+	struct flifo_kunit *ctx = test->priv;
+	const size_t size = *(const size_t *)test->param_value;
+	const int modes[] = { MODE_FIFO, MODE_LIFO };
+	u64 values[4];
+	u64 out[4];
+
+	for (size_t m = 0; m < ARRAY_SIZE(modes); ++m) {
+		configure(&ctx->q, modes[m], size);
+		fill_values(values, 0, 4, size);
+		KUNIT_ASSERT_EQ(test, push(&ctx->q, values, 4 * size), 0);
+
+		flifo_reset_list(&ctx->q);
+		KUNIT_EXPECT_EQ(test, ctx->q.value_count, 0);
+		KUNIT_EXPECT_EQ(test, ctx->q.next_in, 0);
+
+		fill_values(values, 4, 1, size);
+		KUNIT_ASSERT_EQ(test, push(&ctx->q, values, size), 0);
+		KUNIT_ASSERT_EQ(test, pop(&ctx->file, out, size),
+				(ssize_t)size);
+		KUNIT_EXPECT_EQ(test, get_value(out, 0, size),
+				pattern(4, size));
+	}
+}
+
+/**
+ * @brief Measures the enqueues and the dequeues of 8 byte values in batches
+ * of a given size. Each round fills the list with as many batches as fit,
+ * then empties it, the two halves are timed separately.
+ */
+static void flifo_bench(struct kunit *test)
+{
+	struct flifo_kunit *ctx = test->priv;
+	const struct flifo_bench_param *param = test->param_value;
+	const size_t size = sizeof(u64);
+	const size_t count = param->batch * size;
+	const size_t per_round = BENCH_CAPACITY / count;
+	const size_t rounds = max_t(size_t, 1,
+				    BENCH_VALUES / (per_round * param->batch));
+	const u64 moved = (u64)rounds * per_round * param->batch;
+	u64 enqueue_ns = 0;
+	u64 dequeue_ns = 0;
+	u64 start;
+	void *buf;
+
+	KUNIT_ASSERT_EQ(test, flifo_set_capacity(&ctx->q, BENCH_CAPACITY), 0);
+	configure(&ctx->q, param->mode, size);
+	buf = kunit_kmalloc(test, count, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+	fill_values(buf, 0, param->batch, size);
+
+	for (size_t round = 0; round < rounds; ++round) {
+		start = ktime_get_ns();
+		for (size_t i = 0; i < per_round; ++i) {
+			push(&ctx->q, buf, count);
+		}
+		enqueue_ns += ktime_get_ns() - start;
+
+		start = ktime_get_ns();
+		for (size_t i = 0; i < per_round; ++i) {
+			pop(&ctx->file, buf, count);
+		}
+		dequeue_ns += ktime_get_ns() - start;
+	}
+	KUNIT_EXPECT_EQ(test, ctx->q.value_count, 0);
+
+	// Avoid a division by zero on a clock too coarse for short runs
+	enqueue_ns = max_t(u64, enqueue_ns, 1);
+	dequeue_ns = max_t(u64, dequeue_ns, 1);
+	kunit_info(test, "%s, batch %zu: enqueue %llu values/s, dequeue %llu values/s\n",
+		   param->mode == MODE_FIFO ? "fifo" : "lifo", param->batch,
+		   div64_u64(moved * NSEC_PER_SEC, enqueue_ns),
+		   div64_u64(moved * NSEC_PER_SEC, dequeue_ns));
+}
+
+static struct kunit_case flifo_kunit_cases[] = {
+	KUNIT_CASE_PARAM(flifo_test_fifo, value_size_gen_params),
+	KUNIT_CASE_PARAM(flifo_test_lifo, value_size_gen_params),
+	KUNIT_CASE_PARAM(flifo_test_lifo_interleaved, value_size_gen_params),
+	KUNIT_CASE_PARAM(flifo_test_reset, value_size_gen_params),
+	KUNIT_CASE_PARAM(flifo_bench, bench_gen_params),
+	{}
+};
+
+static struct kunit_suite flifo_kunit_suite = {
+	.name = "flifo",
+	.init = flifo_kunit_init,
+	.exit = flifo_kunit_exit,
+	.test_cases = flifo_kunit_cases,
+};
+
+kunit_test_suite(flifo_kunit_suite);
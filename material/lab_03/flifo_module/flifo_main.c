@@ -0,0 +1,1809 @@
+#include <linux/device.h> /* Needed for DEVICE_ATTR_RO */
+#include <linux/err.h> /* Needed for ERR_PTR */
+#include <linux/eventfd.h> /* Needed for eventfd_signal */
+#include <linux/fs.h> /* Needed for file_operations */
+#include <linux/init.h> /* Needed for the macros */
+#include <linux/version.h> /* Needed for LINUX_VERSION_CODE */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h> /* Needed for io_uring_cmd */
+#else
+#include <linux/io_uring.h> /* Needed for io_uring_cmd */
+#endif
+#include <linux/kernel.h> /* Needed for KERN_INFO */
+#include <linux/list.h> /* Needed for the readers of a list */
+#include <linux/minmax.h> /* Needed for min and swap */
+#include <linux/miscdevice.h> /* Needed for misc_register */
+#include <linux/mm.h> /* Needed for vm_area_struct */
+#include <linux/module.h> /* Needed by all modules */
+#include <linux/mutex.h> /* Needed for mutexes */
+#include <linux/overflow.h> /* Needed for check_mul_overflow */
+#include <linux/percpu.h> /* Needed for the statistics */
+#include <linux/poll.h> /* Needed for poll_wait */
+#include <linux/sched.h> /* Needed for current */
+#include <linux/slab.h> /* Needed for kzalloc */
+#include <linux/string.h>
+#include <linux/timekeeping.h> /* Needed for ktime_get_ns */
+#include <linux/uaccess.h> /* copy_(to|from)_user */
+#include <linux/uio.h> /* Needed for iov_iter */
+#include <linux/vmalloc.h> /* Needed for remap_vmalloc_range */
+#include <linux/wait.h> /* Needed for wait queues */
+#include <asm/barrier.h> /* Needed for smp_load_acquire */
+
+#include "flifo.h"
+#include "flifo_core.h"
+
+#define CREATE_TRACE_POINTS
+#include "flifo_trace.h"
+
+#define DEVICE_NAME "flifo"
+
+#define MAX_DEVICES 64
+
+static unsigned long default_capacity = FLIFO_DEFAULT_CAPACITY;
+module_param_named(capacity, default_capacity, ulong, 0444);
+MODULE_PARM_DESC(capacity,
+		 "Initial capacity of the lists in bytes, rounded up to a power of two");
+
+static unsigned int nb_devices = 1;
+module_param(nb_devices, uint, 0444);
+MODULE_PARM_DESC(nb_devices,
+		 "Number of shared lists, exposed as /dev/flifo0 to /dev/flifoN-1");
+
+/**
+ * struct flifo_dev - A misc device giving access to lists.
+ * @miscdev: The misc device, its minor is allocated dynamically.
+ * @name:    Name of the device file.
+ * @queue:   The list shared by every user of the device, unused if the
+ *	     device gives a private list to each open file.
+ * @private: Each open file gets its own private list.
+ */
+struct flifo_dev {
+	struct miscdevice miscdev;
+	char name[16];
+	struct flifo queue;
+	bool private;
+};
+
+// nb_devices shared lists followed by the device of the private lists
+static struct flifo_dev *devices;
+
+/**
+ * @brief Tells the userspace peer of the shared ring that we are about to
+ * sleep, so that it rings the doorbell after its next update. The barrier
+ * orders the flag before the ring state is checked again and pairs with the
+ * one of the peer between its update and its check of the flag.
+ *
+ * @param waiting Waiting flag of our side of the ring.
+ */
+static void shm_announce_waiter(__u32 *waiting)
+{
+	WRITE_ONCE(*waiting, 1);
+	smp_mb();
+}
+
+/**
+ * @brief Imports a single userspace buffer in an iterator. import_ubuf()
+ * replaced import_single_range() in 6.4, which was removed later on.
+ *
+ * @param rw   Direction of the transfer, READ or WRITE.
+ * @param buf  Userspace buffer.
+ * @param len  Length of the buffer.
+ * @param iov  Storage of the vector on kernels older than 6.4.
+ * @param iter Iterator to initialize.
+ *
+ * @return 0 on success, -EFAULT if the buffer is not accessible.
+ */
+static int import_user_buf(int rw, void __user *buf, size_t len,
+			   struct iovec *iov, struct iov_iter *iter)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	return import_ubuf(rw, buf, len, iter);
+#else
+	return import_single_range(rw, buf, len, iov, iter);
+#endif
+}
+
+/**
+ * @brief Signals the eventfd of the list if the fill level crossed the
+ * watermark since it was `before`, with the lock held.
+ *
+ * @param before Fill level before the update of the list.
+ */
+static void watermark_check(struct flifo *q, size_t before)
+{
+	const size_t after = list_fill(q);
+
+	if (q->eventfd &&
+	    (before < q->watermark) != (after < q->watermark)) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+		eventfd_signal(q->eventfd);
+#else
+		eventfd_signal(q->eventfd, 1);
+#endif
+	}
+}
+
+/**
+ * @brief Accounts a write in the statistics of the list.
+ *
+ * @param ret Result of the write, the number of bytes written or an error.
+ */
+static void stats_push(struct flifo *q, ssize_t ret)
+{
+	if (ret >= 0) {
+		this_cpu_inc(q->stats->pushes);
+		this_cpu_add(q->stats->bytes_in, ret);
+	} else if (ret == -EAGAIN || ret == -EINVAL) {
+		this_cpu_inc(q->stats->rejected);
+	}
+}
+
+/**
+ * @brief Accounts a read in the statistics of the list.
+ *
+ * @param count Number of bytes asked for.
+ * @param ret   Result of the read, the number of bytes read or an error.
+ */
+static void stats_pop(struct flifo *q, size_t count, ssize_t ret)
+{
+	if (ret < 0) {
+		return;
+	}
+	this_cpu_inc(q->stats->pops);
+	this_cpu_add(q->stats->bytes_out, ret);
+	if (ret < count) {
+		this_cpu_inc(q->stats->short_reads);
+	}
+}
+
+/**
+ * @brief Records the fill level after a write if it is the highest so far,
+ * with the lock held.
+ */
+static void update_high_water(struct flifo *q)
+{
+	const size_t fill = list_fill(q);
+
+	if (fill > q->high_water) {
+		WRITE_ONCE(q->high_water, fill);
+	}
+}
+
+/**
+ * @brief Drops the stamped values older than the ttl, with the lock held.
+ * They are always the oldest values of the list: at the read position in
+ * FIFO mode and at the bottom of the stack in LIFO mode, so in both cases
+ * dropping them only shrinks value_count. The writers are woken up if some
+ * space was freed.
+ */
+static void expire_values(struct flifo *q)
+{
+	const size_t size = q->value_size;
+	const size_t before = q->value_count;
+	size_t oldest;
+	u64 now;
+
+	if (!is_stamped(q) || q->ttl == 0 || q->value_count == 0) {
+		return;
+	}
+	now = ktime_get_ns();
+	while (q->value_count) {
+		if (q->mode == MODE_FIFO) {
+			oldest = (q->next_in - q->value_count) & q->mask;
+		} else {
+			oldest = (q->next_in + q->value_count - size) & q->mask;
+		}
+		if (now - q->stamps[stamp_index(q, oldest)] <= q->ttl) {
+			break;
+		}
+		q->value_count -= size;
+		q->expired++;
+	}
+	if (q->value_count != before) {
+		watermark_check(q, before);
+		wake_up_interruptible(&q->write_wq);
+	}
+}
+
+/**
+ * @brief Locks a shard of the list in relaxed mode.
+ *
+ * @param i  Any number, usually a CPU id, mapped to a shard.
+ * @param nr Number of shards in use, read before taking the lock.
+ *
+ * @return The locked shard, ERR_PTR(-ESTALE) if the list is not in relaxed
+ * mode or its layout changed, the caller has to start over.
+ */
+static struct flifo_shard *relaxed_lock_shard(struct flifo *q, unsigned int i,
+					      unsigned int nr)
+{
+	struct flifo_shard *shard = &q->shards[i & (nr - 1)];
+
+	mutex_lock(&shard->lock);
+	if (q->mode != MODE_RELAXED || q->nr_shards != nr) {
+		mutex_unlock(&shard->lock);
+		return ERR_PTR(-ESTALE);
+	}
+	return shard;
+}
+
+/**
+ * @brief Moves the count oldest bytes of a shard to the buffers of an
+ * iterator, in at most two runs like ring_to_iter.
+ *
+ * @param shard Locked shard holding at least count bytes.
+ * @param to    Destination iterator, advanced by the copy.
+ * @param count Number of bytes to move.
+ *
+ * @return 0 on success, -EFAULT if a buffer of the iterator is invalid, the
+ * shard is left untouched then.
+ */
+static int shard_to_iter(struct flifo *q, struct flifo_shard *shard,
+			 struct iov_iter *to, size_t count)
+{
+	const size_t first = min(count, q->shard_capacity - shard->out);
+	uint8_t *base = q->values + shard->start;
+
+	if (copy_to_iter(base + shard->out, first, to) != first ||
+	    copy_to_iter(base, count - first, to) != count - first) {
+		return -EFAULT;
+	}
+	shard->out = (shard->out + count) & (q->shard_capacity - 1);
+	WRITE_ONCE(shard->count, shard->count - count);
+	return 0;
+}
+
+/**
+ * @brief Appends count bytes from the buffers of an iterator to a shard, in
+ * at most two runs like ring_from_iter.
+ *
+ * @param shard Locked shard with room for count bytes.
+ * @param from  Source iterator, advanced by the copy.
+ * @param count Number of bytes to append.
+ *
+ * @return 0 on success, -EFAULT if a buffer of the iterator is invalid, the
+ * shard is left untouched then.
+ */
+static int shard_from_iter(struct flifo *q, struct flifo_shard *shard,
+			   struct iov_iter *from, size_t count)
+{
+	const size_t in =
+		(shard->out + shard->count) & (q->shard_capacity - 1);
+	const size_t first = min(count, q->shard_capacity - in);
+	uint8_t *base = q->values + shard->start;
+
+	if (copy_from_iter(base + in, first, from) != first ||
+	    copy_from_iter(base, count - first, from) != count - first) {
+		return -EFAULT;
+	}
+	WRITE_ONCE(shard->count, shard->count + count);
+	return 0;
+}
+
+/**
+ * @brief Returns the number of bytes stored in the shards of the list, exact
+ * only with every shard lock held.
+ */
+static size_t relaxed_fill(struct flifo *q)
+{
+	const unsigned int nr = READ_ONCE(q->nr_shards);
+	size_t fill = 0;
+
+	for (unsigned int i = 0; i < nr; ++i) {
+		fill += READ_ONCE(q->shards[i].count);
+	}
+	return fill;
+}
+
+/**
+ * @brief Wait condition of the readers in relaxed mode, checked without any
+ * lock. Also true when the list left relaxed mode.
+ */
+static bool relaxed_readable(struct flifo *q)
+{
+	const unsigned int nr = READ_ONCE(q->nr_shards);
+
+	if (READ_ONCE(q->mode) != MODE_RELAXED) {
+		return true;
+	}
+	for (unsigned int i = 0; i < nr; ++i) {
+		if (READ_ONCE(q->shards[i].count) >= READ_ONCE(q->value_size)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Wait condition of the writers in relaxed mode, checked without any
+ * lock. Also true when the list left relaxed mode or the request can't fit
+ * in any shard, so that the writer reports it.
+ */
+static bool relaxed_writable(struct flifo *q, size_t count)
+{
+	const unsigned int nr = READ_ONCE(q->nr_shards);
+	const size_t shard_capacity = READ_ONCE(q->shard_capacity);
+
+	if (READ_ONCE(q->mode) != MODE_RELAXED || count > shard_capacity) {
+		return true;
+	}
+	for (unsigned int i = 0; i < nr; ++i) {
+		if (shard_capacity - READ_ONCE(q->shards[i].count) >= count) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Reads values in relaxed mode, from the shard of the current CPU
+ * first and then stealing from the other shards. Only one shard lock is held
+ * at a time. The read returns as soon as some values were read and only
+ * blocks while every shard is empty.
+ *
+ * @param to       the iterator over the userspace buffers receiving the values
+ * @param count    the maximum number of bytes to read
+ * @param nonblock fail with -EAGAIN instead of sleeping
+ *
+ * @return Number of bytes read, -EINVAL if count is not a multiple of the
+ * value size, -EAGAIN if nonblock is set and the list is empty, -EFAULT if a
+ * userspace buffer is invalid, -ESTALE if the list left relaxed mode.
+ */
+static ssize_t relaxed_read(struct flifo *q, struct iov_iter *to,
+			    size_t count, bool nonblock)
+{
+	const unsigned int cpu = raw_smp_processor_id();
+	struct flifo_shard *shard;
+	unsigned int nr;
+	size_t done = 0;
+	size_t n;
+	int ret;
+
+	for (;;) {
+		nr = READ_ONCE(q->nr_shards);
+		for (unsigned int i = 0; i < nr && done < count; ++i) {
+			shard = relaxed_lock_shard(q, cpu + i, nr);
+			if (IS_ERR(shard)) {
+				ret = PTR_ERR(shard);
+				goto out;
+			}
+			n = min(count - done, shard->count);
+			if (count % q->value_size != 0) {
+				ret = -EINVAL;
+			} else {
+				ret = shard_to_iter(q, shard, to, n);
+			}
+			if (!ret && n) {
+				trace_flifo_dequeue(q, n, shard->count);
+			}
+			done += ret ? 0 : n;
+			mutex_unlock(&shard->lock);
+			if (ret) {
+				goto out;
+			}
+		}
+		if (done) {
+			break;
+		}
+		if (nonblock) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(q->read_wq, relaxed_readable(q))) {
+			return -ERESTARTSYS;
+		}
+	}
+out:
+	if (!done) {
+		return ret;
+	}
+	// Only pay for the wake up when a writer sleeps
+	if (wq_has_sleeper(&q->write_wq)) {
+		wake_up_interruptible(&q->write_wq);
+	}
+	return done;
+}
+
+/**
+ * @brief Writes values in relaxed mode, to the shard of the current CPU or,
+ * if it is too full, to the first other shard with enough room. All the
+ * values go to the same shard so they are read back in order.
+ *
+ * @param from     the iterator over the userspace buffers containing the
+ * values
+ * @param count    the number of bytes to write
+ * @param nonblock fail with -EAGAIN instead of sleeping
+ *
+ * @return Number of bytes written, -EINVAL if count is not a multiple of the
+ * value size or exceeds the capacity of a shard, -EAGAIN if nonblock is set
+ * and no shard has enough room, -EFAULT if a userspace buffer is invalid,
+ * -ESTALE if the list left relaxed mode.
+ */
+static ssize_t relaxed_write(struct flifo *q, struct iov_iter *from,
+			     size_t count, bool nonblock)
+{
+	const unsigned int cpu = raw_smp_processor_id();
+	struct flifo_shard *shard;
+	unsigned int nr;
+	bool fits;
+	int ret;
+
+	for (;;) {
+		nr = READ_ONCE(q->nr_shards);
+		for (unsigned int i = 0; i < nr; ++i) {
+			shard = relaxed_lock_shard(q, cpu + i, nr);
+			if (IS_ERR(shard)) {
+				return PTR_ERR(shard);
+			}
+			ret = 0;
+			fits = q->shard_capacity - shard->count >= count;
+			if (count % q->value_size != 0 ||
+			    count > q->shard_capacity) {
+				ret = -EINVAL;
+			} else if (fits) {
+				ret = shard_from_iter(q, shard, from, count);
+				if (!ret) {
+					trace_flifo_enqueue(q, count,
+							    shard->count);
+				}
+			}
+			mutex_unlock(&shard->lock);
+			if (ret) {
+				return ret;
+			}
+			if (fits) {
+				if (wq_has_sleeper(&q->read_wq)) {
+					wake_up_interruptible(&q->read_wq);
+				}
+				return count;
+			}
+		}
+		if (nonblock) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(q->write_wq,
+					     relaxed_writable(q, count))) {
+			return -ERESTARTSYS;
+		}
+	}
+}
+
+/**
+ * @brief Adds a file to the readers of its list, with the lock held, unless
+ * it is one already. In broadcast mode it starts with the values kept for
+ * the other readers.
+ */
+static void reader_join(struct flifo_file *file)
+{
+	struct flifo *q = file->q;
+
+	if (!list_empty(&file->node)) {
+		return;
+	}
+	file->id = q->next_reader_id++;
+	file->cursor = q->head;
+	if (q->mode == MODE_BROADCAST) {
+		file->cursor -= q->value_count;
+	}
+	list_add_tail(&file->node, &q->readers);
+}
+
+/**
+ * @brief Locks the list once it holds at least count bytes. The
+ * configuration may change while we sleep so the request is checked again
+ * on every wake up.
+ *
+ * @param file     Open file of the reader.
+ * @param count    Number of bytes the reader wants.
+ * @param nonblock Fail with -EAGAIN instead of sleeping.
+ *
+ * @return 0 with the lock held, -EINVAL if count is not a multiple of the
+ * value size or exceeds the capacity, -EAGAIN if nonblock is set and not
+ * enough values are available, -ERESTARTSYS if interrupted, -ESTALE if the
+ * list is in relaxed mode.
+ */
+static int lock_readable(struct flifo_file *file, size_t count, bool nonblock)
+{
+	DEFINE_WAIT_FUNC(wait, woken_wake_function);
+	struct flifo *q = file->q;
+	int ret;
+
+	if (mutex_lock_interruptible(&q->lock)) {
+		return -ERESTARTSYS;
+	}
+	reader_join(file);
+	add_wait_queue(&q->read_wq, &wait);
+	for (;;) {
+		if (q->mode == MODE_RELAXED) {
+			ret = -ESTALE;
+			break;
+		}
+		ret = check_read(q, count);
+		if (ret) {
+			break;
+		}
+		expire_values(q);
+		if (reader_fill(file) >= read_need(q, count)) {
+			remove_wait_queue(&q->read_wq, &wait);
+			return 0;
+		}
+		if (nonblock) {
+			ret = -EAGAIN;
+			break;
+		}
+		// The peer clears the flag when it rings, announce again and
+		// check the ring once more before sleeping
+		if (q->mode == MODE_SHARED &&
+		    !READ_ONCE(q->shm->consumer_waiting)) {
+			shm_announce_waiter(&q->shm->consumer_waiting);
+			continue;
+		}
+		mutex_unlock(&q->lock);
+
+		wait_woken(&wait, TASK_INTERRUPTIBLE, MAX_SCHEDULE_TIMEOUT);
+		if (signal_pending(current) ||
+		    mutex_lock_interruptible(&q->lock)) {
+			remove_wait_queue(&q->read_wq, &wait);
+			return -ERESTARTSYS;
+		}
+	}
+	remove_wait_queue(&q->read_wq, &wait);
+	mutex_unlock(&q->lock);
+	return ret;
+}
+
+/**
+ * @brief Reads values from the list to the buffers of an iterator, shared
+ * by the read_iter and uring_cmd callbacks. All the buffers are filled as
+ * one request of their total size.
+ * The call blocks until enough bytes are available in the list, unless
+ * nonblock is set.
+ *
+ * @param file     Open file of the reader.
+ * @param to       Iterator over the userspace buffers to fill, not empty.
+ * @param nonblock Fail with -EAGAIN instead of sleeping.
+ *
+ * @return Number of bytes written in the userspace buffers, -EINVAL if the
+ * total size is not a multiple of the value size or exceeds the capacity,
+ * -EAGAIN if the call can't block and not enough values are available,
+ * -EMSGSIZE if the next message doesn't fit in the buffers.
+ */
+static ssize_t flifo_do_read(struct flifo_file *file, struct iov_iter *to,
+			     bool nonblock)
+{
+	struct flifo *q = file->q;
+	const size_t count = iov_iter_count(to);
+	size_t before;
+	ssize_t ret;
+
+	// The relaxed mode doesn't use the list lock, the mode may change
+	// while we choose the path so we start over when it does
+	for (;;) {
+		if (READ_ONCE(q->mode) == MODE_RELAXED) {
+			ret = relaxed_read(q, to, count, nonblock);
+			if (ret != -ESTALE) {
+				goto out;
+			}
+		}
+		ret = lock_readable(file, count, nonblock);
+		if (ret != -ESTALE) {
+			break;
+		}
+	}
+	if (ret) {
+		goto out;
+	}
+	DBG("Reading %lu values\n", count / q->value_size);
+
+	before = list_fill(q);
+	ret = flifo_read_from_list(file, to, count);
+	DBG("Read Ok, next_in: %lu\n", q->next_in);
+	if (ret >= 0) {
+		trace_flifo_dequeue(q, ret, list_fill(q));
+	}
+	watermark_check(q, before);
+	mutex_unlock(&q->lock);
+	if (ret >= 0) {
+		// Some space was freed, let the writers check if they fit now
+		wake_up_interruptible(&q->write_wq);
+	}
+out:
+	stats_pop(q, count, ret);
+	return ret;
+}
+
+/**
+ * @brief Device file read_iter callback to read values from the list, used
+ * by read, readv and io_uring, see flifo_do_read. The call doesn't block if
+ * the file was opened with O_NONBLOCK or the caller asked not to wait.
+ *
+ * @param iocb Kernel I/O control block of the request.
+ * @param to   Iterator over the userspace buffers to fill.
+ *
+ * @return Number of bytes written in the userspace buffers or a negative
+ * error code, see flifo_do_read.
+ */
+static ssize_t flifo_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct flifo_file *file = iocb->ki_filp->private_data;
+	const bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+			      (iocb->ki_flags & IOCB_NOWAIT);
+
+	if (iov_iter_count(to) == 0) {
+		return 0;
+	}
+
+	// This a simple usage of ki_pos to avoid infinit loop with `cat`
+	// it may not be the correct way to do.
+	if (iocb->ki_pos != 0) {
+		return 0;
+	}
+	iocb->ki_pos = 0;
+
+	return flifo_do_read(file, to, nonblock);
+}
+
+/**
+ * @brief Locks the list once there is room for count more bytes. The
+ * configuration may change while we sleep so the request is checked again
+ * on every wake up.
+ *
+ * @param count    Number of bytes the writer wants to add.
+ * @param nonblock Fail with -EAGAIN instead of sleeping.
+ *
+ * @return 0 with the lock held, -EINVAL if count is not a multiple of the
+ * value size or exceeds the capacity, -EAGAIN if nonblock is set and the
+ * list is too full, -ERESTARTSYS if interrupted, -ESTALE if the list is in
+ * relaxed mode.
+ */
+static int lock_writable(struct flifo *q, size_t count, bool nonblock)
+{
+	DEFINE_WAIT_FUNC(wait, woken_wake_function);
+	int ret;
+
+	if (mutex_lock_interruptible(&q->lock)) {
+		return -ERESTARTSYS;
+	}
+	add_wait_queue(&q->write_wq, &wait);
+	for (;;) {
+		if (q->mode == MODE_RELAXED) {
+			ret = -ESTALE;
+			break;
+		}
+		ret = check_write(q, count);
+		if (ret) {
+			break;
+		}
+		expire_values(q);
+		if (q->capacity - list_fill(q) >= write_need(q, count)) {
+			remove_wait_queue(&q->write_wq, &wait);
+			return 0;
+		}
+		if (nonblock) {
+			ret = -EAGAIN;
+			break;
+		}
+		// The peer clears the flag when it rings, announce again and
+		// check the ring once more before sleeping
+		if (q->mode == MODE_SHARED &&
+		    !READ_ONCE(q->shm->producer_waiting)) {
+			shm_announce_waiter(&q->shm->producer_waiting);
+			continue;
+		}
+		mutex_unlock(&q->lock);
+
+		wait_woken(&wait, TASK_INTERRUPTIBLE, MAX_SCHEDULE_TIMEOUT);
+		if (signal_pending(current) ||
+		    mutex_lock_interruptible(&q->lock)) {
+			remove_wait_queue(&q->write_wq, &wait);
+			return -ERESTARTSYS;
+		}
+	}
+	remove_wait_queue(&q->write_wq, &wait);
+	mutex_unlock(&q->lock);
+	return ret;
+}
+
+/**
+ * @brief Writes values from the buffers of an iterator to the list, shared
+ * by the write_iter and uring_cmd callbacks. All the buffers are added as
+ * one request of their total size.
+ * The call blocks until there is room for all the values in the list, unless
+ * nonblock is set.
+ *
+ * @param file     Open file of the writer.
+ * @param from     Iterator over the userspace buffers holding the values, not
+ * empty.
+ * @param nonblock Fail with -EAGAIN instead of sleeping.
+ *
+ * @return Number of bytes read from the userspace buffers, -EINVAL if the
+ * total size is not a multiple of the value size or exceeds the capacity (in
+ * message mode, if the message can't fit in the list), -EAGAIN if the call
+ * can't block and the list is too full.
+ */
+static ssize_t flifo_do_write(struct flifo_file *file, struct iov_iter *from,
+			      bool nonblock)
+{
+	struct flifo *q = file->q;
+	const size_t count = iov_iter_count(from);
+	size_t before;
+	ssize_t ret;
+
+	// Same as flifo_do_read, start over if the mode changes
+	for (;;) {
+		if (READ_ONCE(q->mode) == MODE_RELAXED) {
+			ret = relaxed_write(q, from, count, nonblock);
+			if (ret != -ESTALE) {
+				goto out;
+			}
+		}
+		ret = lock_writable(q, count, nonblock);
+		if (ret != -ESTALE) {
+			break;
+		}
+	}
+	if (ret) {
+		goto out;
+	}
+	DBG("Writing %lu values\n", count / q->value_size);
+
+	// Copy the values straight from the user space buffers to the list
+	before = list_fill(q);
+	ret = flifo_write_to_list(q, from, count, q->value_size);
+	DBG("Write Ok, next_id %lu\n", q->next_in);
+	if (!ret) {
+		trace_flifo_enqueue(q, count, list_fill(q));
+		update_high_water(q);
+	}
+	watermark_check(q, before);
+	mutex_unlock(&q->lock);
+	if (!ret) {
+		// New values are available, let the readers check if they
+		// have enough
+		wake_up_interruptible(&q->read_wq);
+		ret = count;
+	}
+out:
+	stats_push(q, ret);
+	return ret;
+}
+
+/**
+ * @brief Device file write_iter callback to add values to the list, used by
+ * write, writev and io_uring, see flifo_do_write. The call doesn't block if
+ * the file was opened with O_NONBLOCK or the caller asked not to wait.
+ *
+ * @param iocb Kernel I/O control block of the request.
+ * @param from Iterator over the userspace buffers holding the values.
+ *
+ * @return Number of bytes read from the userspace buffers or a negative
+ * error code, see flifo_do_write.
+ */
+static ssize_t flifo_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct flifo_file *file = iocb->ki_filp->private_data;
+	const bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+			      (iocb->ki_flags & IOCB_NOWAIT);
+
+	if (iov_iter_count(from) == 0) {
+		return 0;
+	}
+	iocb->ki_pos = 0;
+
+	return flifo_do_write(file, from, nonblock);
+}
+
+/**
+ * @brief Device file uring_cmd callback, pushes or pops values on behalf of
+ * an IORING_OP_URING_CMD submission, see struct flifo_uring_cmd. The command
+ * completes inline: when io_uring asks not to block and the list isn't ready,
+ * -EAGAIN makes it retry the command from a worker that may sleep.
+ *
+ * @param ioucmd      The command, its cmd_op is FLIFO_URING_CMD_PUSH or
+ * FLIFO_URING_CMD_POP.
+ * @param issue_flags IO_URING_F_* flags of the submission.
+ *
+ * @return Number of bytes pushed or popped, or a negative error code like
+ * the equivalent write or read, -EINVAL if the operation is unknown.
+ */
+static int flifo_uring_cmd(struct io_uring_cmd *ioucmd,
+			   unsigned int issue_flags)
+{
+	struct flifo_file *file = ioucmd->file->private_data;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 6, 0)
+	const struct flifo_uring_cmd *cmd = io_uring_sqe_cmd(ioucmd->sqe);
+#else
+	const struct flifo_uring_cmd *cmd = ioucmd->cmd;
+#endif
+	const bool nonblock = (ioucmd->file->f_flags & O_NONBLOCK) ||
+			      (issue_flags & IO_URING_F_NONBLOCK);
+	const bool push = ioucmd->cmd_op == FLIFO_URING_CMD_PUSH;
+	struct iov_iter iter;
+	struct iovec iov;
+	u64 count;
+	int ret;
+
+	if (ioucmd->cmd_op != FLIFO_URING_CMD_PUSH &&
+	    ioucmd->cmd_op != FLIFO_URING_CMD_POP) {
+		return -EINVAL;
+	}
+	// The command lives in the SQE, userspace may still change it
+	count = READ_ONCE(cmd->count);
+	if (count > FLIFO_MAX_CAPACITY) {
+		return -EINVAL;
+	}
+	if (count == 0) {
+		return 0;
+	}
+	ret = import_user_buf(push ? WRITE : READ,
+			      u64_to_user_ptr(READ_ONCE(cmd->buf)), count, &iov,
+			      &iter);
+	if (ret) {
+		return ret;
+	}
+	return push ? flifo_do_write(file, &iter, nonblock) :
+		      flifo_do_read(file, &iter, nonblock);
+}
+
+/**
+ * @brief Device file poll callback. The list is readable as soon as one
+ * value (or message) is stored and writable as long as one more value fits.
+ *
+ * @param filp File structure of the char device being polled.
+ * @param wait Poll table to register our wait queues in.
+ *
+ * @return Mask of the events ready on the list.
+ */
+static __poll_t flifo_poll(struct file *filp, poll_table *wait)
+{
+	struct flifo_file *file = filp->private_data;
+	struct flifo *q = file->q;
+	__poll_t events = 0;
+	__poll_t requested = poll_requested_events(wait);
+
+	poll_wait(filp, &q->read_wq, wait);
+	poll_wait(filp, &q->write_wq, wait);
+
+	mutex_lock(&q->lock);
+	expire_values(q);
+	if (q->mode == MODE_SHARED) {
+		// The caller may sleep, ask the userspace peer for a doorbell
+		if (requested & EPOLLIN) {
+			shm_announce_waiter(&q->shm->consumer_waiting);
+		}
+		if (requested & EPOLLOUT) {
+			shm_announce_waiter(&q->shm->producer_waiting);
+		}
+	}
+	if (q->mode == MODE_RELAXED) {
+		if (relaxed_readable(q)) {
+			events |= EPOLLIN | EPOLLRDNORM;
+		}
+		if (relaxed_writable(q, q->value_size)) {
+			events |= EPOLLOUT | EPOLLWRNORM;
+		}
+	} else {
+		if (reader_fill(file) >= read_need(q, q->value_size)) {
+			events |= EPOLLIN | EPOLLRDNORM;
+		}
+		// In message mode, as long as a one byte message fits
+		if (q->capacity - list_fill(q) >=
+		    write_need(q, is_msg_mode(q->mode) ? 1 : q->value_size)) {
+			events |= EPOLLOUT | EPOLLWRNORM;
+		}
+	}
+	mutex_unlock(&q->lock);
+
+	return events;
+}
+
+/**
+ * @brief Checks if the integer value is valid 
+ * Size should be 1, 2, 4 or 8
+ * @param arg the argument to check
+ * @return 1 if size is valid, 0 otherwise 
+ */
+static int is_size_valid(unsigned long arg)
+{
+	int possible_values[] = { 1, 2, 4, 8 };
+	ssize_t size = sizeof(possible_values) / sizeof(possible_values[0]);
+	for (int i = 0; i < size; ++i) {
+		if (possible_values[i] == arg) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Takes every shard lock, with the list lock held. The shard locks
+ * are taken before the map lock: copying from userspace under a shard lock
+ * may fault and take the mmap lock, under which the map lock is taken.
+ */
+static void lock_shards(struct flifo *q)
+{
+	for (unsigned int i = 0; i < q->max_shards; ++i) {
+		mutex_lock_nest_lock(&q->shards[i].lock, &q->lock);
+	}
+}
+
+static void unlock_shards(struct flifo *q)
+{
+	for (unsigned int i = q->max_shards; i-- > 0;) {
+		mutex_unlock(&q->shards[i].lock);
+	}
+}
+
+/**
+ * @brief Copies an entry of a batch from userspace.
+ *
+ * @param entries Userspace array of entries.
+ * @param i       Index of the entry to copy.
+ * @param entry   Destination of the copy.
+ *
+ * @return 0 on success, -EFAULT if the entry is invalid, -EINVAL if its size
+ * can't fit in any list.
+ */
+static int get_batch_entry(struct flifo_batch_entry __user *entries, u32 i,
+			   struct flifo_batch_entry *entry)
+{
+	if (copy_from_user(entry, &entries[i], sizeof(*entry)) != 0) {
+		return -EFAULT;
+	}
+	// Checked before count is narrowed to a size_t
+	if (entry->count > FLIFO_MAX_CAPACITY) {
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * @brief Pushes or pops the entries of a batch under a single lock of the
+ * list. Each entry behaves like a write() or read() of its buffer, only the
+ * first one may block and the batch stops at the first entry that can't be
+ * satisfied right away. The result of each processed entry is written back
+ * to userspace, including the error of the entry that stopped the batch.
+ *
+ * @param filp File structure of the char device.
+ * @param arg  Userspace address of the struct flifo_batch.
+ * @param push Push the entries if true, pop them otherwise.
+ *
+ * @return Number of entries fully processed, or the error of the first entry
+ * if none could be processed.
+ */
+static long flifo_batch(struct file *filp, unsigned long arg, bool push)
+{
+	struct flifo_file *file = filp->private_data;
+	struct flifo *q = file->q;
+	const bool nonblock = filp->f_flags & O_NONBLOCK;
+	struct flifo_batch_entry __user *entries;
+	struct flifo_batch_entry entry;
+	struct flifo_batch batch;
+	struct iov_iter iter;
+	struct iovec iov;
+	size_t available;
+	size_t before;
+	ssize_t moved;
+	u32 done = 0;
+	int ret;
+
+	if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)) != 0) {
+		return -EFAULT;
+	}
+	if (batch.nb_entries > FLIFO_MAX_BATCH || batch.reserved != 0) {
+		return -EINVAL;
+	}
+	if (batch.nb_entries == 0) {
+		return 0;
+	}
+	entries = u64_to_user_ptr(batch.entries);
+
+	ret = get_batch_entry(entries, 0, &entry);
+	if (ret) {
+		goto result;
+	}
+	ret = push ? lock_writable(q, entry.count, nonblock) :
+		     lock_readable(file, entry.count, nonblock);
+	if (ret == -ESTALE) {
+		// No single lock to batch under in relaxed mode
+		ret = -EOPNOTSUPP;
+	}
+	if (ret) {
+		goto result;
+	}
+	before = list_fill(q);
+	for (;;) {
+		ret = import_user_buf(push ? WRITE : READ,
+				      u64_to_user_ptr(entry.buf), entry.count,
+				      &iov, &iter);
+		if (ret) {
+			break;
+		}
+		if (push) {
+			ret = flifo_write_to_list(q, &iter, entry.count,
+					    q->value_size);
+			moved = entry.count;
+		} else {
+			// A message may be shorter than the buffer
+			moved = flifo_read_from_list(file, &iter, entry.count);
+			ret = moved < 0 ? moved : 0;
+		}
+		if (ret) {
+			break;
+		}
+		if (push) {
+			trace_flifo_enqueue(q, moved, list_fill(q));
+			stats_push(q, moved);
+		} else {
+			trace_flifo_dequeue(q, moved, list_fill(q));
+			stats_pop(q, entry.count, moved);
+		}
+		if (put_user((s64)moved, &entries[done].result)) {
+			ret = -EFAULT;
+			break;
+		}
+		if (++done == batch.nb_entries) {
+			break;
+		}
+
+		// The following entries never wait, the list is ours already
+		ret = get_batch_entry(entries, done, &entry);
+		if (ret) {
+			break;
+		}
+		ret = push ? check_write(q, entry.count) :
+			     check_read(q, entry.count);
+		if (ret) {
+			break;
+		}
+		available = push ? q->capacity - list_fill(q) :
+				   reader_fill(file);
+		if (available < (push ? write_need(q, entry.count) :
+					read_need(q, entry.count))) {
+			ret = -EAGAIN;
+			break;
+		}
+	}
+	if (push) {
+		update_high_water(q);
+	}
+	watermark_check(q, before);
+	mutex_unlock(&q->lock);
+
+	if (done) {
+		// Same wake ups as the equivalent writes or reads
+		wake_up_interruptible(push ? &q->read_wq : &q->write_wq);
+	}
+result:
+	if (ret && push) {
+		stats_push(q, ret);
+	}
+	if (ret && done < batch.nb_entries) {
+		// Best effort, the ioctl already reports how far the batch went
+		put_user((s64)ret, &entries[done].result);
+	}
+	if (done) {
+		return done;
+	}
+	return ret;
+}
+
+/**
+ * @brief Registers the eventfd signaled when the fill level of the list
+ * crosses a watermark, replacing the previous one.
+ *
+ * @param q
+ * @param arg Userspace address of the struct flifo_eventfd.
+ *
+ * @return 0 on success, -EFAULT if arg is invalid, -EINVAL if the watermark
+ * is 0 or the reserved field is set, -EBADF if fd is not an eventfd.
+ */
+static long flifo_set_eventfd(struct flifo *q, unsigned long arg)
+{
+	struct eventfd_ctx *ctx = NULL;
+	struct flifo_eventfd efd;
+
+	if (copy_from_user(&efd, (void __user *)arg, sizeof(efd)) != 0) {
+		return -EFAULT;
+	}
+	if (efd.reserved != 0 || (efd.fd >= 0 && efd.watermark == 0)) {
+		return -EINVAL;
+	}
+	if (efd.fd >= 0) {
+		ctx = eventfd_ctx_fdget(efd.fd);
+		if (IS_ERR(ctx)) {
+			return PTR_ERR(ctx);
+		}
+	}
+
+	mutex_lock(&q->lock);
+	swap(q->eventfd, ctx);
+	q->watermark = efd.watermark;
+	mutex_unlock(&q->lock);
+
+	// Drop the reference on the previous eventfd, if any
+	if (ctx) {
+		eventfd_ctx_put(ctx);
+	}
+	return 0;
+}
+
+/**
+ * @brief Gives the length of the next message of the list without reading
+ * it, so that the reader can size its buffer.
+ *
+ * @param q
+ * @param len Userspace destination of the length.
+ *
+ * @return 0 on success, -EINVAL if the list is not in message mode, -EAGAIN
+ * if it is empty, -EFAULT if len is invalid.
+ */
+static long flifo_peek_len(struct flifo *q, u32 __user *len)
+{
+	u32 next;
+
+	if (mutex_lock_interruptible(&q->lock)) {
+		return -ERESTARTSYS;
+	}
+	if (!is_msg_mode(q->mode)) {
+		mutex_unlock(&q->lock);
+		return -EINVAL;
+	}
+	if (q->value_count == 0) {
+		mutex_unlock(&q->lock);
+		return -EAGAIN;
+	}
+	next = *(u32 *)(q->values + msg_out(q));
+	mutex_unlock(&q->lock);
+
+	return put_user(next, len) ? -EFAULT : 0;
+}
+
+/**
+ * @brief Device file ioctl callback. This permits to modify the behavior of the
+ * module.
+ *        - If the command is FLIFO_CMD_RESET, then the list is reset.
+ *        - If the command is FLIFO_CMD_CHANGE_MODE, then the arguments will
+ * determine the list's mode between FIFO (MODE_FIFO), LIFO (MODE_LIFO),
+ * the mmap-able shared ring (MODE_SHARED), the priority queue (MODE_PRIO)
+ * the broadcast ring (MODE_BROADCAST), the per-CPU shards (MODE_RELAXED) and
+ * the messages in FIFO (MODE_MSG_FIFO) or LIFO (MODE_MSG_LIFO) order
+ *        - If the command is FLIFO_CMD_SET_PRIO_ORDER, then the argument tells
+ * if the smallest (PRIO_MIN_FIRST) or largest (PRIO_MAX_FIRST) value is read
+ * first in MODE_PRIO. The values already stored are reordered.
+ *        - If the command is FLIFO_CMD_SET_CAPACITY, then the argument is the
+ * new capacity of the list in bytes. It is rounded up to a power of two and
+ * the list is reset.
+ *        - If the command is FLIFO_CMD_DOORBELL, then the sleeping readers and
+ * writers are woken up. Used by the userspace side of the shared ring.
+ *        - If the command is FLIFO_CMD_PUSH_BATCH or FLIFO_CMD_POP_BATCH, then
+ * the argument points to a struct flifo_batch whose entries are pushed or
+ * popped in a single call, see flifo_batch.
+ *        - If the command is FLIFO_CMD_PEEK_LEN, then the length of the next
+ * message is written to the __u32 the argument points to, in message mode.
+ *        - If the command is FLIFO_CMD_SET_EVENTFD, then the argument points
+ * to a struct flifo_eventfd to signal when the fill level crosses a watermark.
+ *        - If the command is FLIFO_CMD_SET_TIMESTAMPS, then the argument tells
+ * if the values written in FIFO or LIFO mode are stamped, see flifo_set_timestamps.
+ *        - If the command is FLIFO_CMD_SET_TTL, then the argument is the time
+ * to live of the stamped values in microseconds, 0 to keep them forever,
+ * -EINVAL if it doesn't fit in 64 bits of nanoseconds.
+ * The mode, value size and capacity can't change while the shared ring is
+ * mapped by userspace.
+ *
+ * @param filp File structure of the char device to which ioctl is performed.
+ * @param cmd  Command value of the ioctl
+ * @param arg  Optionnal argument of the ioctl
+ *
+ * @return 0 if ioctl succeed (the number of processed entries for a batch),
+ * -1 or a negative error code otherwise.
+ */
+static long flifo_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct flifo_file *file = filp->private_data;
+	struct flifo *q = file->q;
+	bool reset = false;
+	size_t dropped;
+	size_t before;
+	u64 ttl;
+	int ret = 0;
+
+	// The peer of the shared ring made progress, no need for the lock
+	if (cmd == FLIFO_CMD_DOORBELL) {
+		wake_up_interruptible(&q->read_wq);
+		wake_up_interruptible(&q->write_wq);
+		return 0;
+	}
+	// Batches take the lock themselves, like read and write
+	if (cmd == FLIFO_CMD_PUSH_BATCH || cmd == FLIFO_CMD_POP_BATCH) {
+		return flifo_batch(filp, arg, cmd == FLIFO_CMD_PUSH_BATCH);
+	}
+	// Doesn't change anything, the list lock is enough
+	if (cmd == FLIFO_CMD_PEEK_LEN) {
+		return flifo_peek_len(q, (u32 __user *)arg);
+	}
+	if (cmd == FLIFO_CMD_SET_EVENTFD) {
+		return flifo_set_eventfd(q, arg);
+	}
+
+	if (mutex_lock_interruptible(&q->lock)) {
+		return -ERESTARTSYS;
+	}
+	// The relaxed mode reads the configuration under any shard lock
+	lock_shards(q);
+	mutex_lock(&q->map_lock);
+	before = list_fill(q);
+	dropped = q->mode == MODE_RELAXED ? relaxed_fill(q) : before;
+	switch (cmd) {
+	case FLIFO_CMD_RESET:
+		flifo_reset_list(q);
+		reset = true;
+		break;
+
+	case FLIFO_CMD_CHANGE_MODE:
+		if (arg != MODE_FIFO && arg != MODE_LIFO &&
+		    arg != MODE_SHARED && arg != MODE_PRIO &&
+		    arg != MODE_BROADCAST && arg != MODE_RELAXED &&
+		    arg != MODE_MSG_FIFO && arg != MODE_MSG_LIFO) {
+			ret = -1;
+			break;
+		}
+		if (q->nb_mappings) {
+			ret = -EBUSY;
+			break;
+		}
+		q->mode = arg;
+		q->mode_switches++;
+		pr_info("Resetting list\n");
+		flifo_reset_list(q);
+		reset = true;
+		break;
+	case FLIFO_CMD_CHANGE_VALUE_SIZE:
+		if (!is_size_valid(arg)) {
+			pr_err("Invalid value size\n");
+			ret = -1;
+			break;
+		}
+		if (q->nb_mappings) {
+			ret = -EBUSY;
+			break;
+		}
+		ret = flifo_set_value_size(q, arg);
+		if (ret) {
+			break;
+		}
+		DBG("Value size changed to %lu\n", q->value_size);
+		pr_info("Resetting list\n");
+		flifo_reset_list(q);
+		reset = true;
+		break;
+	case FLIFO_CMD_SET_CAPACITY:
+		if (q->nb_mappings) {
+			ret = -EBUSY;
+			break;
+		}
+		ret = flifo_set_capacity(q, arg);
+		if (ret) {
+			pr_err("Invalid capacity %lu\n", arg);
+			break;
+		}
+		pr_info("Capacity changed to %zu, resetting list\n",
+			q->capacity);
+		reset = true;
+		break;
+	case FLIFO_CMD_SET_TIMESTAMPS:
+		ret = flifo_set_timestamps(q, arg);
+		reset = !ret && arg;
+		break;
+	case FLIFO_CMD_SET_TTL:
+		// A wrapped product would expire values much too early
+		if (check_mul_overflow((u64)arg, (u64)NSEC_PER_USEC, &ttl)) {
+			ret = -EINVAL;
+			break;
+		}
+		q->ttl = ttl;
+		break;
+	case FLIFO_CMD_SET_PRIO_ORDER:
+		if (arg != PRIO_MIN_FIRST && arg != PRIO_MAX_FIRST) {
+			ret = -1;
+			break;
+		}
+		q->prio_order = arg;
+		// The values are kept, only their order changes
+		if (q->mode == MODE_PRIO) {
+			flifo_heap_build(q);
+		}
+		break;
+	default:
+		break;
+	}
+	// A reset empties the list
+	if (reset) {
+		trace_flifo_reset(q, dropped, 0);
+	}
+	watermark_check(q, before);
+	mutex_unlock(&q->map_lock);
+	unlock_shards(q);
+	mutex_unlock(&q->lock);
+
+	// The list was reset or reconfigured, sleepers must check their
+	// request again
+	wake_up_interruptible(&q->read_wq);
+	wake_up_interruptible(&q->write_wq);
+	return ret;
+}
+
+static void flifo_vm_open(struct vm_area_struct *vma)
+{
+	struct flifo *q = vma->vm_private_data;
+
+	mutex_lock(&q->map_lock);
+	q->nb_mappings++;
+	mutex_unlock(&q->map_lock);
+}
+
+static void flifo_vm_close(struct vm_area_struct *vma)
+{
+	struct flifo *q = vma->vm_private_data;
+
+	mutex_lock(&q->map_lock);
+	q->nb_mappings--;
+	mutex_unlock(&q->map_lock);
+}
+
+static const struct vm_operations_struct flifo_vm_ops = {
+	.open = flifo_vm_open,
+	.close = flifo_vm_close,
+};
+
+/**
+ * @brief Device file mmap callback. Maps the shared header at offset 0 and
+ * the ring data at offset PAGE_SIZE. Only possible in MODE_SHARED.
+ *
+ * @param filp File structure of the char device being mapped.
+ * @param vma  Userspace area to map the ring in.
+ *
+ * @return 0 on success, -EINVAL if the list is not in shared mode or the area
+ * is bigger than the ring.
+ */
+static int flifo_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct flifo_file *file = filp->private_data;
+	struct flifo *q = file->q;
+	int ret;
+
+	mutex_lock(&q->map_lock);
+	if (q->mode != MODE_SHARED) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+	ret = remap_vmalloc_range(vma, q->shm, vma->vm_pgoff);
+	if (ret) {
+		goto unlock;
+	}
+	vma->vm_ops = &flifo_vm_ops;
+	vma->vm_private_data = q;
+	// vm_ops->open is not called for the first mapping
+	q->nb_mappings++;
+unlock:
+	mutex_unlock(&q->map_lock);
+	return ret;
+}
+
+/**
+ * @brief Device file open callback. Attaches the list to the file: the list
+ * of the device for /dev/flifoN, a new list owned by the file for
+ * /dev/flifo_private. A file opened read only joins the readers of the
+ * list, in broadcast mode it only sees the values written from now on.
+ * Read-write files join on their first read instead.
+ *
+ * @param inode Inode of the device file.
+ * @param filp  File structure of the char device being opened. The misc
+ * framework set its private_data to our miscdevice.
+ *
+ * @return 0 on success, -ENOMEM if the file or the private list could not be
+ * allocated.
+ */
+static int flifo_open(struct inode *inode, struct file *filp)
+{
+	struct flifo_dev *dev =
+		container_of(filp->private_data, struct flifo_dev, miscdev);
+	struct flifo_file *file;
+	struct flifo *q;
+	int ret;
+
+	file = kzalloc(sizeof(*file), GFP_KERNEL);
+	if (!file) {
+		return -ENOMEM;
+	}
+
+	if (dev->private) {
+		q = kzalloc(sizeof(*q), GFP_KERNEL);
+		if (!q) {
+			ret = -ENOMEM;
+			goto free_file;
+		}
+		ret = flifo_init_queue(q, default_capacity);
+		if (ret) {
+			kfree(q);
+			goto free_file;
+		}
+		q->is_private = true;
+	} else {
+		q = &dev->queue;
+	}
+	file->q = q;
+	file->pid = task_tgid_vnr(current);
+	INIT_LIST_HEAD(&file->node);
+
+	// Read-write files join the readers on their first read
+	if ((filp->f_mode & (FMODE_READ | FMODE_WRITE)) == FMODE_READ) {
+		mutex_lock(&q->lock);
+		reader_join(file);
+		mutex_unlock(&q->lock);
+	}
+	filp->private_data = file;
+	return 0;
+
+free_file:
+	kfree(file);
+	return ret;
+}
+
+/**
+ * @brief Device file release callback. Leaves the readers of the list, which
+ * may free space in broadcast mode, and frees the list if it belonged to the
+ * file. Called once the last mapping of the file is gone, so the storage is
+ * not mapped anymore.
+ *
+ * @param inode Inode of the device file.
+ * @param filp  File structure of the char device being closed.
+ *
+ * @return 0
+ */
+static int flifo_release(struct inode *inode, struct file *filp)
+{
+	struct flifo_file *file = filp->private_data;
+	struct flifo *q = file->q;
+	bool freed = false;
+	size_t before;
+
+	if (!list_empty(&file->node)) {
+		mutex_lock(&q->lock);
+		list_del(&file->node);
+		if (q->mode == MODE_BROADCAST) {
+			before = q->value_count;
+			freed = flifo_broadcast_trim(q);
+			watermark_check(q, before);
+		}
+		mutex_unlock(&q->lock);
+	}
+
+	if (q->is_private) {
+		flifo_destroy_queue(q);
+		kfree(q);
+	} else if (freed) {
+		wake_up_interruptible(&q->write_wq);
+	}
+	kfree(file);
+	return 0;
+}
+
+/**
+ * @brief Returns the shared list of a device.
+ */
+static struct flifo *device_queue(struct device *device)
+{
+	struct miscdevice *miscdev = dev_get_drvdata(device);
+
+	return &container_of(miscdev, struct flifo_dev, miscdev)->queue;
+}
+
+/**
+ * @brief Sysfs show callback listing the readers of a shared list, one per
+ * line: its identifier, the pid of the process that opened it and, in
+ * broadcast mode, how many values it has yet to read.
+ *
+ * @param device The device of the list.
+ * @param attr   The readers attribute.
+ * @param buf    Buffer to fill, one page.
+ *
+ * @return Number of bytes written in buf.
+ */
+static ssize_t readers_show(struct device *device,
+			    struct device_attribute *attr, char *buf)
+{
+	struct flifo *q = device_queue(device);
+	struct flifo_file *reader;
+	size_t lag;
+	int len = 0;
+
+	if (mutex_lock_interruptible(&q->lock)) {
+		return -ERESTARTSYS;
+	}
+	list_for_each_entry(reader, &q->readers, node) {
+		lag = 0;
+		if (q->mode == MODE_BROADCAST) {
+			lag = (q->head - reader->cursor) / q->value_size;
+		}
+		len += sysfs_emit_at(buf, len, "%u %d %zu\n", reader->id,
+				     reader->pid, lag);
+	}
+	mutex_unlock(&q->lock);
+	return len;
+}
+
+static DEVICE_ATTR_RO(readers);
+
+/**
+ * @brief Sysfs show callback of the latency histogram of a shared list, one
+ * bucket per line: the lower bound of the bucket in nanoseconds and the
+ * number of stamped values read after spending that long in the list. The
+ * buckets after the last used one are not shown.
+ *
+ * @param device The device of the list.
+ * @param attr   The latency attribute.
+ * @param buf    Buffer to fill, one page.
+ *
+ * @return Number of bytes written in buf.
+ */
+static ssize_t latency_show(struct device *device,
+			    struct device_attribute *attr, char *buf)
+{
+	struct flifo *q = device_queue(device);
+	unsigned int used = 0;
+	int len = 0;
+
+	if (mutex_lock_interruptible(&q->lock)) {
+		return -ERESTARTSYS;
+	}
+	for (unsigned int i = 0; i < LATENCY_BUCKETS; ++i) {
+		if (q->latency[i]) {
+			used = i + 1;
+		}
+	}
+	for (unsigned int i = 0; i < used; ++i) {
+		len += sysfs_emit_at(buf, len, "%llu %llu\n",
+				     i ? 1ULL << i : 0ULL, q->latency[i]);
+	}
+	mutex_unlock(&q->lock);
+	return len;
+}
+
+static DEVICE_ATTR_RO(latency);
+
+/**
+ * @brief Sysfs show callback of the number of stamped values of a shared
+ * list dropped because they outlived the ttl.
+ */
+static ssize_t expired_show(struct device *device,
+			    struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%llu\n",
+			  READ_ONCE(device_queue(device)->expired));
+}
+
+static DEVICE_ATTR_RO(expired);
+
+static struct attribute *flifo_attrs[] = {
+	&dev_attr_readers.attr,
+	&dev_attr_latency.attr,
+	&dev_attr_expired.attr,
+	NULL,
+};
+
+static const struct attribute_group flifo_group = {
+	.attrs = flifo_attrs,
+};
+
+/**
+ * @brief Sums a counter of struct flifo_stats over every CPU.
+ *
+ * @param offset Offset of the counter in struct flifo_stats.
+ */
+static u64 stats_sum(struct flifo *q, size_t offset)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		sum += *(u64 *)((char *)per_cpu_ptr(q->stats, cpu) + offset);
+	}
+	return sum;
+}
+
+// One read only file per counter of struct flifo_stats in the stats directory
+#define FLIFO_STAT_ATTR(field)                                                \
+	static ssize_t field##_show(struct device *device,                   \
+				    struct device_attribute *attr, char *buf) \
+	{                                                                     \
+		return sysfs_emit(buf, "%llu\n",                              \
+				  stats_sum(device_queue(device),             \
+					    offsetof(struct flifo_stats,      \
+						     field)));                \
+	}                                                                     \
+	static DEVICE_ATTR_RO(field)
+
+FLIFO_STAT_ATTR(pushes);
+FLIFO_STAT_ATTR(pops);
+FLIFO_STAT_ATTR(bytes_in);
+FLIFO_STAT_ATTR(bytes_out);
+FLIFO_STAT_ATTR(rejected);
+FLIFO_STAT_ATTR(short_reads);
+
+static ssize_t high_water_show(struct device *device,
+			       struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%zu\n",
+			  READ_ONCE(device_queue(device)->high_water));
+}
+
+static DEVICE_ATTR_RO(high_water);
+
+/**
+ * @brief Sysfs show callback of the number of bytes stored in a shared list,
+ * the sum of the shards in relaxed mode.
+ */
+static ssize_t fill_show(struct device *device, struct device_attribute *attr,
+			 char *buf)
+{
+	struct flifo *q = device_queue(device);
+	size_t fill;
+
+	if (mutex_lock_interruptible(&q->lock)) {
+		return -ERESTARTSYS;
+	}
+	fill = q->mode == MODE_RELAXED ? relaxed_fill(q) : list_fill(q);
+	mutex_unlock(&q->lock);
+	return sysfs_emit(buf, "%zu\n", fill);
+}
+
+static DEVICE_ATTR_RO(fill);
+
+static ssize_t mode_switches_show(struct device *device,
+				  struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%lu\n",
+			  READ_ONCE(device_queue(device)->mode_switches));
+}
+
+static DEVICE_ATTR_RO(mode_switches);
+
+static struct attribute *flifo_stats_attrs[] = {
+	&dev_attr_pushes.attr,
+	&dev_attr_pops.attr,
+	&dev_attr_bytes_in.attr,
+	&dev_attr_bytes_out.attr,
+	&dev_attr_rejected.attr,
+	&dev_attr_short_reads.attr,
+	&dev_attr_high_water.attr,
+	&dev_attr_fill.attr,
+	&dev_attr_mode_switches.attr,
+	NULL,
+};
+
+// The counters of a list, in the stats directory of its device
+static const struct attribute_group flifo_stats_group = {
+	.name = "stats",
+	.attrs = flifo_stats_attrs,
+};
+
+static const struct attribute_group *flifo_groups[] = {
+	&flifo_group,
+	&flifo_stats_group,
+	NULL,
+};
+
+const static struct file_operations flifo_fops = {
+	.owner = THIS_MODULE,
+	.open = flifo_open,
+	.release = flifo_release,
+	.read_iter = flifo_read_iter,
+	.write_iter = flifo_write_iter,
+	.unlocked_ioctl = flifo_ioctl,
+	.poll = flifo_poll,
+	.mmap = flifo_mmap,
+	.uring_cmd = flifo_uring_cmd,
+};
+
+/**
+ * @brief Unregisters the devices and frees their lists.
+ *
+ * @param count Number of devices registered so far.
+ */
+static void flifo_remove_devices(unsigned int count)
+{
+	while (count--) {
+		misc_deregister(&devices[count].miscdev);
+		if (!devices[count].private) {
+			flifo_destroy_queue(&devices[count].queue);
+		}
+	}
+	kfree(devices);
+}
+
+static int __init flifo_init(void)
+{
+	struct flifo_dev *dev;
+	unsigned int i;
+	int ret;
+
+	if (nb_devices > MAX_DEVICES) {
+		pr_err("Too many devices %u, max is %u\n", nb_devices,
+		       MAX_DEVICES);
+		return -EINVAL;
+	}
+
+	// One more device for the private lists
+	devices = kcalloc(nb_devices + 1, sizeof(*devices), GFP_KERNEL);
+	if (!devices) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i <= nb_devices; ++i) {
+		dev = &devices[i];
+		if (i < nb_devices) {
+			snprintf(dev->name, sizeof(dev->name), DEVICE_NAME "%u",
+				 i);
+			ret = flifo_init_queue(&dev->queue, default_capacity);
+			if (ret) {
+				pr_err("Invalid capacity %lu\n",
+				       default_capacity);
+				goto err;
+			}
+		} else {
+			snprintf(dev->name, sizeof(dev->name),
+				 DEVICE_NAME "_private");
+			dev->private = true;
+		}
+
+		dev->miscdev.minor = MISC_DYNAMIC_MINOR;
+		dev->miscdev.name = dev->name;
+		dev->miscdev.fops = &flifo_fops;
+		if (!dev->private) {
+			dev->miscdev.groups = flifo_groups;
+		}
+		ret = misc_register(&dev->miscdev);
+		if (ret) {
+			pr_err("misc_register failed for %s\n", dev->name);
+			if (!dev->private) {
+				flifo_destroy_queue(&dev->queue);
+			}
+			goto err;
+		}
+	}
+
+	pr_info("FLIFO ready with %u shared lists!\n", nb_devices);
+	pr_info("ioctl FLIFO_CMD_RESET: %u\n", FLIFO_CMD_RESET);
+	pr_info("ioctl FLIFO_CMD_CHANGE_MODE: %zu\n", FLIFO_CMD_CHANGE_MODE);
+	pr_info("ioctl FLIFO_CMD_CHANGE_VALUE_SIZE: %zu\n",
+		FLIFO_CMD_CHANGE_VALUE_SIZE);
+	pr_info("ioctl FLIFO_CMD_SET_CAPACITY: %zu\n", FLIFO_CMD_SET_CAPACITY);
+	pr_info("ioctl FLIFO_CMD_DOORBELL: %u\n", FLIFO_CMD_DOORBELL);
+	pr_info("ioctl FLIFO_CMD_PUSH_BATCH: %zu\n", FLIFO_CMD_PUSH_BATCH);
+	pr_info("ioctl FLIFO_CMD_POP_BATCH: %zu\n", FLIFO_CMD_POP_BATCH);
+	pr_info("ioctl FLIFO_CMD_SET_PRIO_ORDER: %zu\n",
+		FLIFO_CMD_SET_PRIO_ORDER);
+	pr_info("ioctl FLIFO_CMD_PEEK_LEN: %zu\n", FLIFO_CMD_PEEK_LEN);
+	pr_info("ioctl FLIFO_CMD_SET_EVENTFD: %zu\n", FLIFO_CMD_SET_EVENTFD);
+	pr_info("ioctl FLIFO_CMD_SET_TIMESTAMPS: %zu\n",
+		FLIFO_CMD_SET_TIMESTAMPS);
+	pr_info("ioctl FLIFO_CMD_SET_TTL: %zu\n", FLIFO_CMD_SET_TTL);
+	pr_info("Initial capacity: %lu\n", default_capacity);
+
+	return 0;
+err:
+	flifo_remove_devices(i);
+	return ret;
+}
+
+static void __exit flifo_exit(void)
+{
+	flifo_remove_devices(nb_devices + 1);
+	pr_info("FLIFO done!\n");
+}
+
+MODULE_AUTHOR("André Costa");
+MODULE_LICENSE("GPL");
+
+module_init(flifo_init);
+module_exit(flifo_exit);
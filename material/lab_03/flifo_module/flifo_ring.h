@@ -0,0 +1,270 @@
+#ifndef FLIFO_RING_H
+#define FLIFO_RING_H
+
+/*
+ * Userspace side of the flifo shared ring (MODE_SHARED).
+ *
+ * The ring is mapped from the device so values are pushed and popped without
+ * entering the kernel. It is a single producer, single consumer ring: one
+ * side of the ring can be this library or read()/write() on the device, but
+ * there must be only one producer and one consumer at a time.
+ *
+ * A system call is only made to wake up a peer that announced it was going
+ * to sleep, see struct flifo_shm_header.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "flifo.h"
+
+struct flifo_ring {
+	int fd;
+	struct flifo_shm_header *hdr;
+	uint8_t *data;
+	size_t map_size;
+	uint32_t capacity;
+	uint32_t value_size;
+};
+
+/**
+ * @brief Maps the shared ring of a flifo device already in MODE_SHARED.
+ *
+ * @param ring Ring to initialize.
+ * @param fd   File descriptor of the device, opened read-write.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+static inline int flifo_ring_map(struct flifo_ring *ring, int fd)
+{
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	struct flifo_shm_header *hdr;
+	size_t map_size;
+
+	// Map the header alone first to know the size of the ring
+	hdr = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		return -1;
+	}
+	map_size = hdr->data_offset + hdr->capacity;
+	munmap(hdr, page_size);
+
+	hdr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		return -1;
+	}
+	// The capacity can't change anymore, make sure it didn't grow between
+	// the two mappings
+	if (hdr->data_offset + hdr->capacity > map_size) {
+		munmap(hdr, map_size);
+		errno = EBUSY;
+		return -1;
+	}
+
+	ring->fd = fd;
+	ring->hdr = hdr;
+	ring->data = (uint8_t *)hdr + hdr->data_offset;
+	ring->map_size = map_size;
+	ring->capacity = hdr->capacity;
+	ring->value_size = hdr->value_size;
+	return 0;
+}
+
+/**
+ * @brief Unmaps the shared ring.
+ *
+ * @param ring
+ */
+static inline void flifo_ring_unmap(struct flifo_ring *ring)
+{
+	munmap(ring->hdr, ring->map_size);
+	ring->hdr = NULL;
+	ring->data = NULL;
+}
+
+/**
+ * @brief Wakes the peer up if it announced it was going to sleep.
+ * The full barrier orders our index update before the check of the flag and
+ * pairs with the one the peer issues between setting the flag and checking
+ * the ring again.
+ *
+ * @param ring
+ * @param waiting Waiting flag of the peer.
+ */
+static inline void flifo_ring_kick(struct flifo_ring *ring, uint32_t *waiting)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiting, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(waiting, 0, __ATOMIC_RELAXED)) {
+		ioctl(ring->fd, FLIFO_CMD_DOORBELL);
+	}
+}
+
+/**
+ * @brief Pushes as many whole values from buf as fit in the ring.
+ *
+ * @param ring
+ * @param buf   Values to push.
+ * @param count Size of buf in bytes, a multiple of the value size.
+ * @return Number of bytes pushed, possibly 0 if the ring is full, or -1 with
+ * errno set to EINVAL if count is not a multiple of the value size.
+ */
+static inline ssize_t flifo_ring_push(struct flifo_ring *ring, const void *buf,
+				      size_t count)
+{
+	const uint32_t mask = ring->capacity - 1;
+	// We are the producer, the head is ours
+	const uint32_t head = __atomic_load_n(&ring->hdr->head,
+					      __ATOMIC_RELAXED);
+	// Acquire: don't overwrite values the consumer is still reading
+	const uint32_t tail = __atomic_load_n(&ring->hdr->tail,
+					      __ATOMIC_ACQUIRE);
+	const uint32_t room = ring->capacity - (head - tail);
+	size_t first;
+
+	if (count % ring->value_size != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (count > room) {
+		count = room - room % ring->value_size;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	first = ring->capacity - (head & mask);
+	if (first > count) {
+		first = count;
+	}
+	memcpy(ring->data + (head & mask), buf, first);
+	memcpy(ring->data, (const uint8_t *)buf + first, count - first);
+
+	// Release: publish the values only once they are fully written
+	__atomic_store_n(&ring->hdr->head, head + count, __ATOMIC_RELEASE);
+	flifo_ring_kick(ring, &ring->hdr->consumer_waiting);
+	return count;
+}
+
+/**
+ * @brief Pops as many whole values as available, up to count bytes.
+ *
+ * @param ring
+ * @param buf   Destination of the values.
+ * @param count Size of buf in bytes, a multiple of the value size.
+ * @return Number of bytes popped, possibly 0 if the ring is empty, or -1 with
+ * errno set to EINVAL if count is not a multiple of the value size.
+ */
+static inline ssize_t flifo_ring_pop(struct flifo_ring *ring, void *buf,
+				     size_t count)
+{
+	const uint32_t mask = ring->capacity - 1;
+	// We are the consumer, the tail is ours
+	const uint32_t tail = __atomic_load_n(&ring->hdr->tail,
+					      __ATOMIC_RELAXED);
+	// Acquire: don't read values before the producer published them
+	const uint32_t head = __atomic_load_n(&ring->hdr->head,
+					      __ATOMIC_ACQUIRE);
+	const uint32_t fill = head - tail;
+	size_t first;
+
+	if (count % ring->value_size != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (count > fill) {
+		count = fill;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	first = ring->capacity - (tail & mask);
+	if (first > count) {
+		first = count;
+	}
+	memcpy(buf, ring->data + (tail & mask), first);
+	memcpy((uint8_t *)buf + first, ring->data, count - first);
+
+	// Release: hand the space back only once we are done reading it
+	__atomic_store_n(&ring->hdr->tail, tail + count, __ATOMIC_RELEASE);
+	flifo_ring_kick(ring, &ring->hdr->producer_waiting);
+	return count;
+}
+
+/**
+ * @brief Sleeps until the condition of one side of the ring is met.
+ *
+ * @param ring
+ * @param waiting    Our waiting flag.
+ * @param events     Event to poll the device for.
+ * @param timeout_ms Timeout of poll, -1 to wait forever.
+ * @return 0 when the condition is met, -1 with errno set to ETIMEDOUT or to
+ * the error of poll otherwise.
+ */
+static inline int flifo_ring_wait(struct flifo_ring *ring, uint32_t *waiting,
+				  short events, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = ring->fd, .events = events };
+	uint32_t head;
+	uint32_t tail;
+	int ret;
+
+	for (;;) {
+		// Announce we are going to sleep, then check the ring again in
+		// case the peer made progress before seeing the flag
+		__atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		head = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&ring->hdr->tail, __ATOMIC_ACQUIRE);
+		if (events == POLLIN ? head - tail >= ring->value_size :
+				       ring->capacity - (head - tail) >=
+					       ring->value_size) {
+			return 0;
+		}
+
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0 && errno != EINTR) {
+			return -1;
+		}
+		if (ret == 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+}
+
+/**
+ * @brief Sleeps until at least one value can be popped.
+ *
+ * @param ring
+ * @param timeout_ms Timeout in milliseconds, -1 to wait forever.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+static inline int flifo_ring_wait_readable(struct flifo_ring *ring,
+					   int timeout_ms)
+{
+	return flifo_ring_wait(ring, &ring->hdr->consumer_waiting, POLLIN,
+			       timeout_ms);
+}
+
+/**
+ * @brief Sleeps until at least one value can be pushed.
+ *
+ * @param ring
+ * @param timeout_ms Timeout in milliseconds, -1 to wait forever.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+static inline int flifo_ring_wait_writable(struct flifo_ring *ring,
+					   int timeout_ms)
+{
+	return flifo_ring_wait(ring, &ring->hdr->producer_waiting, POLLOUT,
+			       timeout_ms);
+}
+
+#endif /* FLIFO_RING_H */
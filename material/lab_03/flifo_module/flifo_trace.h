@@ -0,0 +1,63 @@
+/*
+ * Tracepoints of the flifo lists, under events/flifo/ in tracefs.
+ *
+ * Each event carries the list, the number of bytes it concerns and the fill
+ * level of the list once done, in bytes. In RELAXED mode the fill level is
+ * the one of the shard the values went to or came from.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM flifo
+
+#if !defined(_FLIFO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _FLIFO_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(flifo_op,
+
+	TP_PROTO(const void *queue, size_t size, size_t fill),
+
+	TP_ARGS(queue, size, fill),
+
+	TP_STRUCT__entry(
+		__field(const void *, queue)
+		__field(size_t, size)
+		__field(size_t, fill)
+	),
+
+	TP_fast_assign(
+		__entry->queue = queue;
+		__entry->size = size;
+		__entry->fill = fill;
+	),
+
+	TP_printk("queue=%p size=%zu fill=%zu", __entry->queue, __entry->size,
+		  __entry->fill)
+);
+
+/* size bytes were written to the list */
+DEFINE_EVENT(flifo_op, flifo_enqueue,
+	TP_PROTO(const void *queue, size_t size, size_t fill),
+	TP_ARGS(queue, size, fill)
+);
+
+/* size bytes were read from the list */
+DEFINE_EVENT(flifo_op, flifo_dequeue,
+	TP_PROTO(const void *queue, size_t size, size_t fill),
+	TP_ARGS(queue, size, fill)
+);
+
+/* The list was reset or reconfigured, size bytes were dropped */
+DEFINE_EVENT(flifo_op, flifo_reset,
+	TP_PROTO(const void *queue, size_t size, size_t fill),
+	TP_ARGS(queue, size, fill)
+);
+
+#endif /* _FLIFO_TRACE_H */
+
+/* The header is not in include/trace/events, tell define_trace.h where */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE flifo_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,58 @@
+#!/bin/bash
+# Runs the KUnit suite of flifo under UML:
+# ./kunit.sh /path/to/linux [options of kunit.py]
+#
+# kunit.py only builds from the kernel tree, so for the duration of the run
+# this directory is linked in drivers/misc/flifo and hooked to the Kconfig
+# and Makefile of drivers/misc. Everything is put back on exit, even when the
+# build or a test fails; the build outputs stay in the build directory of
+# kunit.py, .kunit by default.
+
+set -e
+
+KERNELDIR=$(realpath "$1")
+shift
+FLIFODIR=$(dirname "$(realpath "$0")")
+MISCDIR=$KERNELDIR/drivers/misc
+BACKUPDIR=$(mktemp -d)
+RESTORE=()
+
+restore() {
+	for file in "${RESTORE[@]}"; do
+		cp -p "$BACKUPDIR/$(basename "$file")" "$file"
+		echo "kunit.sh: restored $file"
+	done
+	if [ -L "$MISCDIR/flifo" ]; then
+		rm "$MISCDIR/flifo"
+		echo "kunit.sh: removed $MISCDIR/flifo"
+	fi
+	rm -rf "$BACKUPDIR"
+}
+trap restore EXIT
+
+# Keeps a copy of a file of the tree to put it back on exit
+backup() {
+	cp -p "$1" "$BACKUPDIR/"
+	RESTORE+=("$1")
+}
+
+if [ -e "$MISCDIR/flifo" ] && [ ! -L "$MISCDIR/flifo" ]; then
+	echo "kunit.sh: $MISCDIR/flifo exists, not touching it" >&2
+	exit 1
+fi
+ln -sfn "$FLIFODIR" "$MISCDIR/flifo"
+echo "kunit.sh: linked $MISCDIR/flifo for this run"
+if ! grep -q "drivers/misc/flifo/Kconfig" "$MISCDIR/Kconfig"; then
+	backup "$MISCDIR/Kconfig"
+	# Before the final endmenu
+	sed -i '$i source "drivers/misc/flifo/Kconfig"' "$MISCDIR/Kconfig"
+	echo "kunit.sh: sourcing flifo from $MISCDIR/Kconfig for this run"
+fi
+if ! grep -q "CONFIG_FLIFO" "$MISCDIR/Makefile"; then
+	backup "$MISCDIR/Makefile"
+	echo 'obj-$(CONFIG_FLIFO)		+= flifo/' >>"$MISCDIR/Makefile"
+	echo "kunit.sh: building flifo from $MISCDIR/Makefile for this run"
+fi
+
+cd "$KERNELDIR"
+./tools/testing/kunit/kunit.py run --kunitconfig=drivers/misc/flifo "$@"
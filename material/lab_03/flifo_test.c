@@ -1,10 +1,27 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
 #include "flifo_module/flifo.h"
+#include "flifo_module/flifo_ring.h"
+
+#define SHARED_DEVICE "/dev/flifo0"
+#define PRIVATE_DEVICE "/dev/flifo_private"
+
+// Device under test, used by the tests that need more open files
+static const char *device = SHARED_DEVICE;
 
 /**
  * @brief Set the mode of the list
@@ -49,6 +66,24 @@ int set_value_size(int fd, size_t size)
 	return 0;
 }
 
+/**
+ * @brief Enable or disable O_NONBLOCK on the file descriptor
+ * 
+ * @param fd 
+ * @param enable 
+ * @return int 
+ */
+int set_nonblock(int fd, int enable)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	if (flags < 0) {
+		return -1;
+	}
+	flags = enable ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+	return fcntl(fd, F_SETFL, flags);
+}
+
 /**
  * @brief  Read a value from the file descriptor and check if it is equal to the expected value
  * 
@@ -141,9 +176,15 @@ int test_overflow(int fd)
 		}
 	}
 
+	// Reads block until enough values are available, don't wait here
+	if (set_nonblock(fd, 1) < 0) {
+		perror("fcntl:");
+		return -1;
+	}
 	uint64_t value = 0;
 	ssize_t nb_read = read(fd, (void *)&value, sizeof(uint64_t));
-	if (nb_read > 0) {
+	set_nonblock(fd, 0);
+	if (nb_read > 0 || errno != EAGAIN) {
 		// We should not be able to read more than the number of values
 		return -1;
 	}
@@ -151,6 +192,42 @@ int test_overflow(int fd)
 	return 0;
 }
 
+//make sure poll reports the list state
+int test_poll(int fd)
+{
+	uint32_t value = 1;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN | POLLOUT };
+
+	if (set_value_size(fd, sizeof(uint32_t)) < 0) {
+		perror("set_value_size:");
+		return -1;
+	}
+	// Empty list: only writable
+	if (poll(&pfd, 1, 0) != 1 || pfd.revents != POLLOUT) {
+		return -1;
+	}
+	// Fill the list: only readable
+	for (size_t i = 0; i < FLIFO_DEFAULT_CAPACITY / sizeof(value); i++) {
+		if (write(fd, &value, sizeof(value)) != sizeof(value)) {
+			return -1;
+		}
+	}
+	if (poll(&pfd, 1, 0) != 1 || pfd.revents != POLLIN) {
+		return -1;
+	}
+	// A full list refuses new values without blocking
+	if (set_nonblock(fd, 1) < 0) {
+		perror("fcntl:");
+		return -1;
+	}
+	ssize_t nb_written = write(fd, &value, sizeof(value));
+	set_nonblock(fd, 0);
+	if (nb_written >= 0 || errno != EAGAIN) {
+		return -1;
+	}
+	return 0;
+}
+
 //test the read of multiple values at once
 int test_multi_read(int fd)
 {
@@ -199,15 +276,715 @@ int test_multi_read(int fd)
 	}
 	return 0;
 }
-int (*test_functions[])(int) = { test_uint8_t,	test_uint16_t, test_uint32_t,
-				 test_uint64_t, test_overflow, test_multi_read };
-char *test_names[] = { "uint8_t",  "uint16_t", "uint32_t",
-		       "uint64_t", "overflow", "multi-read" };
-int main()
+
+/**
+ * @brief Set the capacity of the list
+ * 
+ * @param fd 
+ * @param capacity 
+ * @return int 
+ */
+int set_capacity(int fd, unsigned long capacity)
+{
+	if (ioctl(fd, FLIFO_CMD_SET_CAPACITY, capacity) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+//make sure a bigger list can be filled and read back in one call
+int test_capacity(int fd)
+{
+	static uint64_t values[4096];
+	static uint64_t target_buffer[4096];
+	size_t nb_values = sizeof(values) / sizeof(values[0]);
+	int rc = -1;
+
+	// Not a power of two, should be rounded up to sizeof(values)
+	if (set_capacity(fd, sizeof(values) - 1) < 0) {
+		perror("set_capacity:");
+		return -1;
+	}
+	if (set_value_size(fd, sizeof(uint64_t)) < 0) {
+		perror("set_value_size:");
+		goto end;
+	}
+	for (size_t i = 0; i < nb_values; i++) {
+		values[i] = i;
+	}
+	if (write(fd, values, sizeof(values)) != (ssize_t)sizeof(values)) {
+		goto end;
+	}
+	if (read(fd, target_buffer, sizeof(target_buffer)) !=
+	    (ssize_t)sizeof(target_buffer)) {
+		goto end;
+	}
+	for (size_t i = 0; i < nb_values; i++) {
+		if (target_buffer[i] != values[i]) {
+			goto end;
+		}
+	}
+	rc = 0;
+end:
+	if (set_capacity(fd, FLIFO_DEFAULT_CAPACITY) < 0) {
+		perror("set_capacity:");
+		return -1;
+	}
+	return rc;
+}
+static void on_alarm(int sig)
+{
+	(void)sig;
+}
+//a blocking read of the whole ring sleeps across several pushes of a child
+int test_shared_pushes(int fd, struct flifo_ring *ring)
+{
+	uint32_t values[] = { 1, 2, 3, 4 };
+	uint32_t target_buffer[4];
+	struct sigaction action = { .sa_handler = on_alarm };
+	ssize_t len;
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		return -1;
+	}
+	if (pid == 0) {
+		// One value at a time, the reader sleeps again after each one
+		for (size_t i = 0; i < 4; i++) {
+			const ssize_t size = sizeof(values[i]);
+
+			usleep(10000);
+			if (flifo_ring_push(ring, &values[i], size) != size) {
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+
+	// Without SA_RESTART, a lost doorbell ends the read with EINTR
+	sigaction(SIGALRM, &action, NULL);
+	alarm(2);
+	len = read(fd, target_buffer, sizeof(target_buffer));
+	alarm(0);
+	signal(SIGALRM, SIG_DFL);
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		return -1;
+	}
+	if (len != sizeof(target_buffer) ||
+	    memcmp(values, target_buffer, sizeof(values)) != 0) {
+		return -1;
+	}
+	return 0;
+}
+//exchange values between the mapped ring and read/write
+int test_shared(int fd)
+{
+	uint32_t values[] = { 1, 2, 3, 4 };
+	uint32_t target_buffer[4];
+	struct flifo_ring ring;
+	int rc = -1;
+
+	if (set_value_size(fd, sizeof(uint32_t)) < 0) {
+		perror("set_value_size:");
+		return -1;
+	}
+	if (set_mode(fd, MODE_SHARED) < 0) {
+		perror("set_mode:");
+		return -1;
+	}
+	if (flifo_ring_map(&ring, fd) < 0) {
+		perror("flifo_ring_map:");
+		return -1;
+	}
+	// The layout can't change while the ring is mapped
+	if (set_mode(fd, MODE_FIFO) == 0 || errno != EBUSY) {
+		goto end;
+	}
+
+	// Userspace producer, kernel consumer
+	if (flifo_ring_push(&ring, values, sizeof(values)) != sizeof(values)) {
+		goto end;
+	}
+	if (read(fd, target_buffer, sizeof(target_buffer)) !=
+		    sizeof(target_buffer) ||
+	    memcmp(values, target_buffer, sizeof(values)) != 0) {
+		goto end;
+	}
+
+	// Kernel producer, userspace consumer
+	if (write(fd, values, sizeof(values)) != sizeof(values)) {
+		goto end;
+	}
+	if (flifo_ring_wait_readable(&ring, 0) < 0 ||
+	    flifo_ring_pop(&ring, target_buffer, sizeof(target_buffer)) !=
+		    sizeof(target_buffer) ||
+	    memcmp(values, target_buffer, sizeof(values)) != 0) {
+		goto end;
+	}
+	// Nothing left
+	if (flifo_ring_pop(&ring, target_buffer, sizeof(target_buffer)) != 0) {
+		goto end;
+	}
+	if (test_shared_pushes(fd, &ring) < 0) {
+		goto end;
+	}
+	rc = 0;
+end:
+	flifo_ring_unmap(&ring);
+	return rc;
+}
+//move values with writev/readv and with the batch ioctls
+int test_batch(int fd)
+{
+	uint16_t values[] = { 1, 2, 3, 4, 5, 6 };
+	uint16_t target_buffer[6] = { 0 };
+	struct iovec iov[] = {
+		{ .iov_base = values, .iov_len = 2 * sizeof(uint16_t) },
+		{ .iov_base = values + 2, .iov_len = 4 * sizeof(uint16_t) },
+	};
+	struct flifo_batch_entry entries[] = {
+		{ .buf = (uintptr_t)values, .count = sizeof(values) },
+		{ .buf = (uintptr_t)values, .count = FLIFO_DEFAULT_CAPACITY },
+	};
+	struct flifo_batch batch = { .entries = (uintptr_t)entries,
+				     .nb_entries = 2 };
+
+	if (set_value_size(fd, sizeof(uint16_t)) < 0) {
+		perror("set_value_size:");
+		return -1;
+	}
+	// Both segments are written as a single request
+	if (writev(fd, iov, 2) != sizeof(values)) {
+		return -1;
+	}
+	iov[0].iov_base = target_buffer;
+	iov[1].iov_base = target_buffer + 2;
+	if (readv(fd, iov, 2) != sizeof(target_buffer) ||
+	    memcmp(values, target_buffer, sizeof(values)) != 0) {
+		return -1;
+	}
+
+	// The second entry doesn't fit anymore, only the first one is pushed
+	if (ioctl(fd, FLIFO_CMD_PUSH_BATCH, &batch) != 1 ||
+	    entries[0].result != sizeof(values) ||
+	    entries[1].result != -EAGAIN) {
+		return -1;
+	}
+	entries[0].buf = (uintptr_t)target_buffer;
+	entries[0].count = 2 * sizeof(uint16_t);
+	entries[1].buf = (uintptr_t)(target_buffer + 2);
+	entries[1].count = 4 * sizeof(uint16_t);
+	memset(target_buffer, 0, sizeof(target_buffer));
+	if (ioctl(fd, FLIFO_CMD_POP_BATCH, &batch) != 2 ||
+	    memcmp(values, target_buffer, sizeof(values)) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+//read values back by priority, smallest then largest first
+int test_prio(int fd)
+{
+	uint32_t values[] = { 42, 7, 1000, 7, 3 };
+	uint32_t min_first[] = { 3, 7, 7, 42, 1000 };
+	uint32_t max_first[] = { 1000, 42, 7, 7, 3 };
+	uint32_t target_buffer[5];
+
+	if (set_value_size(fd, sizeof(uint32_t)) < 0) {
+		perror("set_value_size:");
+		return -1;
+	}
+	if (set_mode(fd, MODE_PRIO) < 0) {
+		perror("set_mode:");
+		return -1;
+	}
+	if (write(fd, values, sizeof(values)) != sizeof(values) ||
+	    read(fd, target_buffer, sizeof(target_buffer)) !=
+		    sizeof(target_buffer) ||
+	    memcmp(min_first, target_buffer, sizeof(min_first)) != 0) {
+		return -1;
+	}
+
+	// Changing the order keeps the values already stored
+	if (write(fd, values, sizeof(values)) != sizeof(values) ||
+	    ioctl(fd, FLIFO_CMD_SET_PRIO_ORDER, PRIO_MAX_FIRST) < 0) {
+		return -1;
+	}
+	for (size_t i = 0; i < 5; i++) {
+		if (read(fd, &target_buffer[i], sizeof(uint32_t)) !=
+		    sizeof(uint32_t)) {
+			return -1;
+		}
+	}
+	ioctl(fd, FLIFO_CMD_SET_PRIO_ORDER, PRIO_MIN_FIRST);
+	if (memcmp(max_first, target_buffer, sizeof(max_first)) != 0) {
+		return -1;
+	}
+	return 0;
+}
+
+//make sure every reader sees every value in broadcast mode
+int read_stat(const char *name, unsigned long long *value);
+int test_broadcast(int fd)
 {
-	int fd = open("/dev/flifo", O_RDWR);
+	uint32_t values[] = { 1, 2, 3, 4 };
+	uint32_t target_buffer[4];
+	unsigned long long fill;
+	int readers[2] = { -1, -1 };
+	int writer = -1;
+	int idle = -1;
+	int rc = -1;
+
+	if (set_value_size(fd, sizeof(uint32_t)) < 0) {
+		perror("set_value_size:");
+		return -1;
+	}
+	if (set_mode(fd, MODE_BROADCAST) < 0) {
+		perror("set_mode:");
+		return -1;
+	}
+	// The writer opens write only so it doesn't count as a reader
+	writer = open(device, O_WRONLY);
+	readers[0] = open(device, O_RDONLY | O_NONBLOCK);
+	readers[1] = open(device, O_RDONLY | O_NONBLOCK);
+	// Never reads, so it must not hold the values back
+	idle = open(device, O_RDWR);
+	if (writer < 0 || readers[0] < 0 || readers[1] < 0 || idle < 0) {
+		perror("open:");
+		goto end;
+	}
+
+	if (write(writer, values, sizeof(values)) != sizeof(values)) {
+		goto end;
+	}
+	// fd joins on its first read, with the values kept for the readers
+	if (read(fd, target_buffer, sizeof(target_buffer)) !=
+		    sizeof(target_buffer) ||
+	    memcmp(values, target_buffer, sizeof(values)) != 0) {
+		goto end;
+	}
+	for (size_t i = 0; i < 2; i++) {
+		memset(target_buffer, 0, sizeof(target_buffer));
+		if (read(readers[i], target_buffer, sizeof(target_buffer)) !=
+			    sizeof(target_buffer) ||
+		    memcmp(values, target_buffer, sizeof(values)) != 0) {
+			goto end;
+		}
+		// Each reader consumes its own view only
+		if (read(readers[i], target_buffer, sizeof(uint32_t)) >= 0 ||
+		    errno != EAGAIN) {
+			goto end;
+		}
+	}
+	// Every reader is done, nothing is kept
+	if (read_stat("fill", &fill) < 0 || fill != 0) {
+		goto end;
+	}
+	rc = 0;
+end:
+	if (writer >= 0) {
+		close(writer);
+	}
+	if (idle >= 0) {
+		close(idle);
+	}
+	for (size_t i = 0; i < 2; i++) {
+		if (readers[i] >= 0) {
+			close(readers[i]);
+		}
+	}
+	return rc;
+}
+
+//values of a single write stay together and in order in relaxed mode
+int test_relaxed(int fd)
+{
+	uint32_t values[] = { 1, 2, 3, 4 };
+	uint32_t target_buffer[8];
+	struct flifo_batch_entry entry = { .buf = (uintptr_t)target_buffer,
+					   .count = sizeof(uint32_t) };
+	struct flifo_batch batch = { .entries = (uintptr_t)&entry,
+				     .nb_entries = 1 };
+
+	if (set_value_size(fd, sizeof(uint32_t)) < 0) {
+		perror("set_value_size:");
+		return -1;
+	}
+	if (set_mode(fd, MODE_RELAXED) < 0) {
+		perror("set_mode:");
+		return -1;
+	}
+	if (write(fd, values, sizeof(values)) != sizeof(values)) {
+		return -1;
+	}
+	// Reads may be short, asking for more than stored is fine
+	if (read(fd, target_buffer, sizeof(target_buffer)) != sizeof(values) ||
+	    memcmp(values, target_buffer, sizeof(values)) != 0) {
+		return -1;
+	}
+	if (ioctl(fd, FLIFO_CMD_POP_BATCH, &batch) >= 0 ||
+	    errno != EOPNOTSUPP) {
+		return -1;
+	}
+	return 0;
+}
+
+//each write is read back as one whole message, in FIFO then LIFO order
+int test_message(int fd)
+{
+	const char *messages[] = { "hello", "flifo\n", "hi" };
+	const size_t nb_messages = sizeof(messages) / sizeof(messages[0]);
+	char target_buffer[16];
+	uint32_t len;
+
+	for (int mode = MODE_MSG_FIFO; mode <= MODE_MSG_LIFO; mode++) {
+		if (set_mode(fd, mode) < 0) {
+			perror("set_mode:");
+			return -1;
+		}
+		for (size_t i = 0; i < nb_messages; i++) {
+			if (write(fd, messages[i], strlen(messages[i])) !=
+			    (ssize_t)strlen(messages[i])) {
+				return -1;
+			}
+		}
+		for (size_t i = 0; i < nb_messages; i++) {
+			const char *expected =
+				messages[mode == MODE_MSG_FIFO ?
+						 i :
+						 nb_messages - 1 - i];
+
+			if (ioctl(fd, FLIFO_CMD_PEEK_LEN, &len) < 0 ||
+			    len != strlen(expected)) {
+				return -1;
+			}
+			// A buffer too small leaves the message in the list
+			if (read(fd, target_buffer, len - 1) >= 0 ||
+			    errno != EMSGSIZE) {
+				return -1;
+			}
+			if (read(fd, target_buffer, sizeof(target_buffer)) !=
+				    len ||
+			    memcmp(target_buffer, expected, len) != 0) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+//the eventfd is signaled each time the fill level crosses the watermark
+int test_eventfd(int fd)
+{
+	uint8_t values[] = { 1, 2, 3, 4 };
+	uint8_t target_buffer[4];
+	struct flifo_eventfd efd = { .watermark = 3 };
+	eventfd_t signals;
+	int rc = -1;
+	int event = eventfd(0, EFD_NONBLOCK);
+
+	if (event < 0) {
+		perror("eventfd:");
+		return -1;
+	}
+	efd.fd = event;
+	if (ioctl(fd, FLIFO_CMD_SET_EVENTFD, &efd) < 0) {
+		perror("ioctl:");
+		goto end;
+	}
+	// Below the watermark, nothing to signal
+	write(fd, values, 2);
+	if (eventfd_read(event, &signals) == 0 || errno != EAGAIN) {
+		goto end;
+	}
+	// Up across the watermark and back down
+	write(fd, values, 2);
+	read(fd, target_buffer, 4);
+	if (eventfd_read(event, &signals) < 0 || signals != 2) {
+		goto end;
+	}
+	rc = 0;
+end:
+	// Unregister it so that the other tests don't signal it
+	efd.fd = -1;
+	ioctl(fd, FLIFO_CMD_SET_EVENTFD, &efd);
+	close(event);
+	return rc;
+}
+
+//values older than the ttl are skipped by the next read
+int test_ttl(int fd)
+{
+	uint8_t values[] = { 1, 2, 3, 4 };
+	uint8_t target_buffer[2];
+	int rc = -1;
+
+	if (ioctl(fd, FLIFO_CMD_SET_TIMESTAMPS, 1) < 0 ||
+	    ioctl(fd, FLIFO_CMD_SET_TTL, 1000) < 0) {
+		perror("ioctl:");
+		goto end;
+	}
+	write(fd, values, 2);
+	usleep(10000);
+	write(fd, values + 2, 2);
+	if (read(fd, target_buffer, sizeof(target_buffer)) !=
+		    sizeof(target_buffer) ||
+	    memcmp(target_buffer, values + 2, sizeof(target_buffer)) != 0) {
+		goto end;
+	}
+	// Too long to count in nanoseconds, refused rather than wrapped
+	if (sizeof(unsigned long) == sizeof(uint64_t) &&
+	    (ioctl(fd, FLIFO_CMD_SET_TTL, ~0UL) == 0 || errno != EINVAL)) {
+		goto end;
+	}
+	rc = 0;
+end:
+	ioctl(fd, FLIFO_CMD_SET_TTL, 0);
+	ioctl(fd, FLIFO_CMD_SET_TIMESTAMPS, 0);
+	return rc;
+}
+
+struct test_uring {
+	int fd;
+	struct io_uring_params params;
+	uint8_t *sq;
+	uint8_t *cq;
+	struct io_uring_sqe *sqes;
+};
+
+/**
+ * @brief Submits a flifo command to an io_uring and waits for its completion
+ *
+ * @param ring
+ * @param fd    File descriptor of the device
+ * @param op    FLIFO_URING_CMD_PUSH or FLIFO_URING_CMD_POP
+ * @param buf
+ * @param count
+ * @return int The result of the command
+ */
+int uring_cmd(struct test_uring *ring, int fd, uint32_t op, void *buf,
+	      size_t count)
+{
+	const struct io_sqring_offsets *sq_off = &ring->params.sq_off;
+	const struct io_cqring_offsets *cq_off = &ring->params.cq_off;
+	unsigned *sq_tail = (unsigned *)(ring->sq + sq_off->tail);
+	unsigned *sq_mask = (unsigned *)(ring->sq + sq_off->ring_mask);
+	unsigned *cq_head = (unsigned *)(ring->cq + cq_off->head);
+	unsigned *cq_mask = (unsigned *)(ring->cq + cq_off->ring_mask);
+	struct io_uring_cqe *cqes = (void *)(ring->cq + cq_off->cqes);
+	struct flifo_uring_cmd cmd = { .buf = (uintptr_t)buf, .count = count };
+	unsigned index = *sq_tail & *sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	int res;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_URING_CMD;
+	sqe->fd = fd;
+	sqe->cmd_op = op;
+	memcpy(sqe->cmd, &cmd, sizeof(cmd));
+	((unsigned *)(ring->sq + sq_off->array))[index] = index;
+	__atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+
+	if (syscall(__NR_io_uring_enter, ring->fd, 1, 1,
+		    IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+		return -errno;
+	}
+	res = cqes[*cq_head & *cq_mask].res;
+	__atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+	return res;
+}
+
+//push and pop values with IORING_OP_URING_CMD
+int test_uring(int fd)
+{
+	uint16_t values[] = { 1, 2, 3, 4 };
+	uint16_t target_buffer[4];
+	struct test_uring ring = { 0 };
+	size_t sq_size;
+	size_t cq_size;
+	int rc = -1;
+
+	ring.fd = syscall(__NR_io_uring_setup, 4, &ring.params);
+	if (ring.fd < 0) {
+		perror("io_uring_setup:");
+		return -1;
+	}
+	sq_size = ring.params.sq_off.array +
+		  ring.params.sq_entries * sizeof(unsigned);
+	cq_size = ring.params.cq_off.cqes +
+		  ring.params.cq_entries * sizeof(struct io_uring_cqe);
+	ring.sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       ring.fd, IORING_OFF_SQ_RING);
+	ring.cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		       ring.fd, IORING_OFF_CQ_RING);
+	ring.sqes = mmap(NULL,
+			 ring.params.sq_entries * sizeof(struct io_uring_sqe),
+			 PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd,
+			 IORING_OFF_SQES);
+	if (ring.sq == MAP_FAILED || ring.cq == MAP_FAILED ||
+	    ring.sqes == MAP_FAILED) {
+		perror("mmap:");
+		goto end;
+	}
+
+	if (set_value_size(fd, sizeof(uint16_t)) < 0) {
+		perror("set_value_size:");
+		goto end;
+	}
+	if (uring_cmd(&ring, fd, FLIFO_URING_CMD_PUSH, values,
+		      sizeof(values)) != sizeof(values)) {
+		goto end;
+	}
+	if (uring_cmd(&ring, fd, FLIFO_URING_CMD_POP, target_buffer,
+		      sizeof(target_buffer)) != sizeof(target_buffer) ||
+	    memcmp(values, target_buffer, sizeof(values)) != 0) {
+		goto end;
+	}
+	// Same checks as write
+	if (uring_cmd(&ring, fd, FLIFO_URING_CMD_PUSH, values, 3) != -EINVAL) {
+		goto end;
+	}
+	rc = 0;
+end:
+	// Unmapping MAP_FAILED fails harmlessly
+	munmap(ring.sq, sq_size);
+	munmap(ring.cq, cq_size);
+	munmap(ring.sqes, ring.params.sq_entries * sizeof(struct io_uring_sqe));
+	close(ring.fd);
+	return rc;
+}
+
+//make sure each open of the private device gets its own list
+int test_private(int fd)
+{
+	uint8_t value = 42;
+	uint8_t target;
+	int rc = -1;
+	int first = open(PRIVATE_DEVICE, O_RDWR | O_NONBLOCK);
+	int second = open(PRIVATE_DEVICE, O_RDWR | O_NONBLOCK);
+
+	(void)fd;
+	if (first < 0 || second < 0) {
+		perror("open:");
+		goto end;
+	}
+	if (write(first, &value, sizeof(value)) != sizeof(value)) {
+		goto end;
+	}
+	// The value is not visible from the other list
+	if (read(second, &target, sizeof(target)) >= 0 || errno != EAGAIN) {
+		goto end;
+	}
+	if (read(first, &target, sizeof(target)) != sizeof(target) ||
+	    target != value) {
+		goto end;
+	}
+	rc = 0;
+end:
+	if (first >= 0) {
+		close(first);
+	}
+	if (second >= 0) {
+		close(second);
+	}
+	return rc;
+}
+/**
+ * @brief Reads one of the statistics of the device under test from sysfs
+ *
+ * @param name  Name of the counter in the stats directory
+ * @param value Value read
+ * @return 0 on success, -1 otherwise
+ */
+int read_stat(const char *name, unsigned long long *value)
+{
+	const char *slash = strrchr(device, '/');
+	char path[128];
+	FILE *file;
+	int rc;
+
+	snprintf(path, sizeof(path), "/sys/class/misc/%s/stats/%s",
+		 slash ? slash + 1 : device, name);
+	file = fopen(path, "r");
+	if (!file) {
+		perror("fopen:");
+		return -1;
+	}
+	rc = fscanf(file, "%llu", value) == 1 ? 0 : -1;
+	fclose(file);
+	return rc;
+}
+
+//make sure the counters of the stats directory follow the accesses
+int test_stats(int fd)
+{
+	uint32_t values[4] = { 1, 2, 3, 4 };
+	uint32_t target;
+	unsigned long long pushes[2];
+	unsigned long long pops[2];
+	unsigned long long rejected[2];
+	unsigned long long fill;
+
+	if (set_value_size(fd, sizeof(uint32_t)) < 0) {
+		perror("set_value_size:");
+		return -1;
+	}
+	if (read_stat("pushes", &pushes[0]) < 0 ||
+	    read_stat("pops", &pops[0]) < 0 ||
+	    read_stat("rejected", &rejected[0]) < 0) {
+		return -1;
+	}
+	if (write(fd, values, sizeof(values)) != sizeof(values) ||
+	    read(fd, &target, sizeof(target)) != sizeof(target)) {
+		return -1;
+	}
+	// Not a multiple of the value size
+	if (write(fd, values, 3) >= 0) {
+		return -1;
+	}
+	if (read_stat("pushes", &pushes[1]) < 0 ||
+	    read_stat("pops", &pops[1]) < 0 ||
+	    read_stat("rejected", &rejected[1]) < 0 ||
+	    read_stat("fill", &fill) < 0) {
+		return -1;
+	}
+	if (pushes[1] - pushes[0] != 1 || pops[1] - pops[0] != 1 ||
+	    rejected[1] - rejected[0] != 1 ||
+	    fill != sizeof(values) - sizeof(target)) {
+		return -1;
+	}
+	return 0;
+}
+int (*test_functions[])(int) = { test_uint8_t,	test_uint16_t,
+				 test_uint32_t, test_uint64_t,
+				 test_overflow, test_multi_read,
+				 test_capacity, test_poll,
+				 test_shared,	test_private,
+				 test_batch,	test_prio,
+				 test_broadcast, test_relaxed,
+				 test_message,	 test_eventfd,
+				 test_uring,	 test_ttl,
+				 test_stats };
+char *test_names[] = { "uint8_t",    "uint16_t", "uint32_t",
+		       "uint64_t",   "overflow", "multi-read",
+		       "capacity",   "poll",	 "shared",
+		       "private",    "batch",	 "prio",
+		       "broadcast",  "relaxed",	 "message",
+		       "eventfd",    "uring",	 "ttl",
+		       "stats" };
+int main(int argc, char **argv)
+{
+	// Any of the shared lists can be tested, the first one by default
+	if (argc > 1) {
+		device = argv[1];
+	}
+	int fd = open(device, O_RDWR);
 	if (fd < 0) {
-		printf("Error opening /dev/flifo\n");
+		printf("Error opening %s\n", device);
 		return -1;
 	}
 
@@ -4,142 +4,1544 @@
  */
 
 #include <linux/module.h>
+#include <linux/anon_inodes.h>
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/fs.h>
+#include <linux/gfp.h>
+#include <linux/highmem.h>
+#include <linux/lz4.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/refcount.h>
+#include <linux/pagemap.h>
+#include <linux/rcupdate.h>
+#include <linux/sched/signal.h>
+#include <linux/overflow.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
 #include <linux/cdev.h>
 #include <linux/device.h>
+#include <linux/file.h>
+#include <linux/xarray.h>
 
 #include <linux/string.h>
 
-#define START_BUFFER_CAPACITY 8
-#define MAX_BUFFER_CAPACITY   1024
+#include "parrot.h"
+
+#define DEFAULT_MAX_SIZE (64UL << 20)
+// Lockless attempts of a reader before it waits for the writers
+#define READ_RETRIES	 4
+// Decompressed pages kept for the next reads, in compressed mode
+#define CACHE_SLOTS	 64
+// Marks the pages of the buffer also held by a snapshot
+#define SNAPSHOT_MARK	 XA_MARK_0
+// The kernel may be built without the LZ4 library, the mode is left out then
+#define PARROT_LZ4 \
+	(IS_ENABLED(CONFIG_LZ4_COMPRESS) && IS_ENABLED(CONFIG_LZ4_DECOMPRESS))
 
 #define MAJOR_NUM	      98
 #define MAJMIN		      MKDEV(MAJOR_NUM, 0)
 #define DEVICE_NAME	      "parrot"
 
+static unsigned long max_size = DEFAULT_MAX_SIZE;
+module_param(max_size, ulong, 0644);
+MODULE_PARM_DESC(max_size,
+		 "Maximum size of the stored data in bytes, can be changed at runtime");
+
+static bool compress;
+module_param(compress, bool, 0444);
+MODULE_PARM_DESC(compress,
+		 "Store the data compressed with LZ4, which can't be mapped");
+
 static struct cdev cdev;
 static struct class *cl;
+
+/**
+ * struct buffer - Data written to the device, stored page by page.
+ * @pages: Pages of the data indexed by their position in it. The pages are
+ *	   allocated on the first write to them, so the data grows without
+ *	   being copied. A page never written is absent and reads as zeros.
+ * @size:  Number of bytes of data.
+ * @lock:  Serializes the writers and the changes of the pages.
+ * @seq:   Odd while a writer changes the data or its size. Readers don't
+ *	   take the lock, they check the count to know if they saw a write.
+ *	   Associated to @lock, which lockdep checks the writers hold.
+ * @chunks: In compressed mode, replaces @pages: the data of each page
+ *	   compressed in a struct chunk. Only the writers change it.
+ * @next_id: Id of the next chunk stored, never 0.
+ * @stored: Number of bytes of memory used to store the data.
+ * @lz4_wrkmem: Working memory of the compression, used by the writers.
+ * @lz4_dst: Output of the compression, used by the writers.
+ *
+ * @pages holds a reference to each page. A truncation or a punched hole
+ * removes pages and drops that reference, so a reader or a mapping takes its
+ * own reference to keep using a page, see buffer_find_page. A snapshot holds
+ * a reference too and marks the pages with SNAPSHOT_MARK, the writers copy
+ * such a page before changing it, see buffer_unshare_page.
+ */
 struct buffer {
-	uint8_t *data;
+	struct xarray pages;
+	size_t size;
+	struct mutex lock;
+	seqcount_mutex_t seq;
+	struct xarray chunks;
+	u64 next_id;
+	atomic_long_t stored;
+	void *lz4_wrkmem;
+	void *lz4_dst;
+};
+
+/**
+ * struct chunk - Data of a page compressed with LZ4, never changed once
+ * stored: a write stores a new chunk and drops the old one, which is freed
+ * after an RCU grace period, so lockless readers can still decompress it.
+ * @rcu:  To free the chunk.
+ * @ref:  One reference for the buffer and one per snapshot holding it.
+ * @id:   Unique id of the chunk, to know if a cached page is up to date.
+ * @len:  Length of the data, PAGE_SIZE if it didn't compress and is stored
+ *	  as is.
+ * @data: The compressed data.
+ */
+struct chunk {
+	struct rcu_head rcu;
+	refcount_t ref;
+	u64 id;
+	unsigned int len;
+	u8 data[];
+};
+
+/**
+ * struct cache - Pages recently decompressed or written, in compressed mode,
+ * so repeated reads and small writes to a page don't decompress it again.
+ * The page of index i goes to slot i % CACHE_SLOTS.
+ * @lock:  Protects the slots.
+ * @ids:   Id of the chunk each page holds the data of, 0 for an empty slot.
+ * @pages: The pages. A page isn't changed once cached, a reader takes a
+ *	   reference to copy it without the lock.
+ */
+struct cache {
+	spinlock_t lock;
+	u64 ids[CACHE_SLOTS];
+	struct page *pages[CACHE_SLOTS];
+};
+
+/**
+ * struct snapshot - Data of the buffer frozen by PARROT_SNAPSHOT, read
+ * through its own file. It shares the pages or the chunks of the buffer,
+ * with a reference on each, which are never changed.
+ * @data: The pages, or the chunks in compressed mode.
+ * @size: Number of bytes of data.
+ */
+struct snapshot {
+	struct xarray data;
 	size_t size;
-	size_t capacity;
 };
 
 static struct buffer buffer;
+static struct cache cache;
+
+/**
+ * @brief Tells if the data is stored compressed.
+ */
+static bool buffer_compressed(void)
+{
+	return PARROT_LZ4 && compress;
+}
+
+/**
+ * @brief Returns the number of bytes of memory used by a chunk.
+ */
+static size_t chunk_size(const struct chunk *chunk)
+{
+	return struct_size(chunk, data, chunk->len);
+}
 
 /**
- * @brief Read back previously written data in the internal buffer.
+ * @brief Drops a reference to a chunk, which is freed after an RCU grace
+ * period once unused.
+ */
+static void chunk_put(struct chunk *chunk)
+{
+	if (refcount_dec_and_test(&chunk->ref)) {
+		kfree_rcu(chunk, rcu);
+	}
+}
+
+/**
+ * @brief Returns the page of the buffer at an index with a reference held,
+ * which the caller drops with put_page. Doesn't need the lock.
  *
- * @param filp pointer to the file descriptor in use
- * @param buf destination buffer in user space
- * @param count maximum number of data to read
- * @param ppos current position in file from which data will be read
- *              will be updated to new location
+ * @param index index of the page in the buffer
  *
- * @return Actual number of bytes read from internal buffer,
- *         or a negative error code
+ * @return The page, or NULL if it is absent.
+ */
+static struct page *buffer_find_page(pgoff_t index)
+{
+	struct page *page;
+
+	rcu_read_lock();
+repeat:
+	page = xa_load(&buffer.pages, index);
+	if (page) {
+		// The page may be removed, freed and even reused meanwhile
+		if (!get_page_unless_zero(page)) {
+			goto repeat;
+		}
+		if (unlikely(page != xa_load(&buffer.pages, index))) {
+			put_page(page);
+			goto repeat;
+		}
+	}
+	rcu_read_unlock();
+	return page;
+}
+
+/**
+ * @brief Returns the page of the buffer at an index with a reference held,
+ * allocating a zeroed one if it is absent. The caller drops the reference
+ * with put_page.
+ *
+ * @param index index of the page in the buffer
+ *
+ * @return The page, or NULL if it could not be allocated.
+ */
+static struct page *buffer_get_page(pgoff_t index)
+{
+	struct page *page;
+	struct page *old;
+
+	do {
+		page = buffer_find_page(index);
+		if (page) {
+			return page;
+		}
+		page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+		if (!page) {
+			return NULL;
+		}
+		// One reference for the buffer and one for the caller
+		page_ref_inc(page);
+		old = xa_cmpxchg(&buffer.pages, index, NULL, page, GFP_KERNEL);
+		if (!old) {
+			atomic_long_add(PAGE_SIZE, &buffer.stored);
+			return page;
+		}
+		// Someone stored a page in the meantime, use theirs
+		page_ref_dec(page);
+		__free_page(page);
+	} while (!xa_is_err(old));
+	return NULL;
+}
+
+/**
+ * @brief Returns the cached page holding the data of a chunk, with a
+ * reference held.
+ *
+ * @param index index of the page in the buffer
+ * @param id id of the chunk of the page
+ *
+ * @return The page, or NULL if it isn't cached.
+ */
+static struct page *cache_get(pgoff_t index, u64 id)
+{
+	const unsigned int slot = index % CACHE_SLOTS;
+	struct page *page = NULL;
+
+	spin_lock(&cache.lock);
+	if (cache.ids[slot] == id) {
+		page = cache.pages[slot];
+		get_page(page);
+	}
+	spin_unlock(&cache.lock);
+	return page;
+}
+
+/**
+ * @brief Caches a page holding the data of a chunk, in place of the page
+ * that was in its slot. The page must not be changed afterward.
+ *
+ * @param index index of the page in the buffer
+ * @param id id of the chunk of the page, or 0 to empty the slot if it holds
+ *           the data of chunk old_id
+ * @param old_id the id to check when emptying the slot
+ * @param page the page, NULL to empty the slot
+ */
+static void cache_set(pgoff_t index, u64 id, u64 old_id, struct page *page)
+{
+	const unsigned int slot = index % CACHE_SLOTS;
+	struct page *old = NULL;
+
+	if (page) {
+		get_page(page);
+	}
+	spin_lock(&cache.lock);
+	if (page || cache.ids[slot] == old_id) {
+		old = cache.pages[slot];
+		cache.ids[slot] = id;
+		cache.pages[slot] = page;
+	}
+	spin_unlock(&cache.lock);
+	if (old) {
+		put_page(old);
+	}
+}
+
+/**
+ * @brief Decompresses a chunk in a page.
+ *
+ * @param chunk the chunk
+ * @param page the page, its whole content is replaced
+ *
+ * @return 0, or -EIO if the chunk is corrupted
+ */
+static int chunk_decompress(const struct chunk *chunk, struct page *page)
+{
+	void *kaddr = kmap_local_page(page);
+	int ret = 0;
+
+	if (chunk->len == PAGE_SIZE) {
+		memcpy(kaddr, chunk->data, PAGE_SIZE);
+	} else if (LZ4_decompress_safe(chunk->data, kaddr, chunk->len,
+				       PAGE_SIZE) != PAGE_SIZE) {
+		ret = -EIO;
+	}
+	kunmap_local(kaddr);
+	return ret;
+}
+
+/**
+ * @brief Returns a page holding the data of the buffer at an index, in
+ * compressed mode, with a reference held. The page comes from the cache, or
+ * is decompressed and cached. Doesn't need the lock.
+ *
+ * @param index index of the page in the buffer
+ *
+ * @return The page, NULL for a hole, or an ERR_PTR.
+ */
+static struct page *chunk_read(pgoff_t index)
+{
+	struct page *page = NULL;
+	struct chunk *chunk;
+	u64 id;
+	int err;
+
+	rcu_read_lock();
+	chunk = xa_load(&buffer.chunks, index);
+	if (chunk) {
+		page = cache_get(index, chunk->id);
+	}
+	rcu_read_unlock();
+	if (!chunk || page) {
+		return page;
+	}
+
+	// Can't sleep while the chunk is used, allocate first
+	page = alloc_page(GFP_HIGHUSER);
+	if (!page) {
+		return ERR_PTR(-ENOMEM);
+	}
+	// The chunk may have changed meanwhile, the reader will see it
+	rcu_read_lock();
+	chunk = xa_load(&buffer.chunks, index);
+	if (!chunk) {
+		rcu_read_unlock();
+		put_page(page);
+		return NULL;
+	}
+	id = chunk->id;
+	err = chunk_decompress(chunk, page);
+	rcu_read_unlock();
+	if (err) {
+		put_page(page);
+		return ERR_PTR(err);
+	}
+	cache_set(index, id, 0, page);
+	return page;
+}
+
+/**
+ * @brief Fills a page with the data of the buffer at an index, in compressed
+ * mode. Called with the lock held.
+ *
+ * @param index index of the page in the buffer
+ * @param page the page, its whole content is replaced
+ *
+ * @return 0, or a negative error code
  */
-static ssize_t parrot_read(struct file *filp, char __user *buf, size_t count,
-			   loff_t *ppos)
+static int chunk_fill(pgoff_t index, struct page *page)
 {
-	if (*ppos >= buffer.size) {
+	struct chunk *chunk = xa_load(&buffer.chunks, index);
+	struct page *cached;
+
+	if (!chunk) {
+		clear_highpage(page);
 		return 0;
 	}
-	if (*ppos + count > buffer.size) {
-		count = buffer.size - *ppos;
+	cached = cache_get(index, chunk->id);
+	if (cached) {
+		copy_highpage(page, cached);
+		put_page(cached);
+		return 0;
 	}
-	if (copy_to_user(buf, buffer.data + *ppos, count) != 0) {
-		return -EFAULT;
+	return chunk_decompress(chunk, page);
+}
+
+/**
+ * @brief Compresses a page and stores it as the chunk of an index, in place
+ * of the previous one. The page is cached and must not be changed
+ * afterward. Called with the lock held.
+ *
+ * @param index index of the page in the buffer
+ * @param page the new data of the page
+ *
+ * @return 0, or a negative error code
+ */
+static int chunk_store(pgoff_t index, struct page *page)
+{
+	const void *kaddr = kmap_local_page(page);
+	struct chunk *chunk;
+	struct chunk *old;
+	int len;
+
+	len = LZ4_compress_default(kaddr, buffer.lz4_dst, PAGE_SIZE,
+				   LZ4_COMPRESSBOUND(PAGE_SIZE),
+				   buffer.lz4_wrkmem);
+	kunmap_local(kaddr);
+	// Stored as is if it doesn't compress
+	if (len <= 0 || len >= PAGE_SIZE) {
+		len = PAGE_SIZE;
+	}
+	chunk = kmalloc(struct_size(chunk, data, len), GFP_KERNEL);
+	if (!chunk) {
+		return -ENOMEM;
+	}
+	refcount_set(&chunk->ref, 1);
+	chunk->id = buffer.next_id++;
+	chunk->len = len;
+	if (len == PAGE_SIZE) {
+		memcpy_from_page(chunk->data, page, 0, PAGE_SIZE);
+	} else {
+		memcpy(chunk->data, buffer.lz4_dst, len);
 	}
-	*ppos += count;
 
-	return count;
+	old = xa_store(&buffer.chunks, index, chunk, GFP_KERNEL);
+	if (xa_is_err(old)) {
+		kfree(chunk);
+		return xa_err(old);
+	}
+	atomic_long_add(chunk_size(chunk), &buffer.stored);
+	if (old) {
+		atomic_long_sub(chunk_size(old), &buffer.stored);
+		chunk_put(old);
+	}
+	cache_set(index, chunk->id, 0, page);
+	return 0;
 }
 
 /**
- * @brief Write data to the internal buffer
+ * @brief Writes to the data of the buffer at an index, in compressed mode:
+ * the page is decompressed, written and compressed again. Called with the
+ * lock held.
  *
- * @param filp pointer to the file descriptor in use
- * @param buf source buffer in user space
- * @param count number of data to write in the buffer
- * @param ppos current position in file to which data will be written
- *              will be updated to new location
+ * @param index index of the page in the buffer
+ * @param offset offset in the page of the first byte to write
+ * @param n number of bytes to write, within the page
+ * @param from source of the data
+ *
+ * @return Number of bytes written, or a negative error code
+ */
+static ssize_t chunk_write(pgoff_t index, size_t offset, size_t n,
+			   struct iov_iter *from)
+{
+	struct page *page = alloc_page(GFP_HIGHUSER);
+	size_t copied = 0;
+	int err;
+
+	if (!page) {
+		return -ENOMEM;
+	}
+	err = chunk_fill(index, page);
+	if (!err) {
+		copied = copy_page_from_iter(page, offset, n, from);
+	}
+	if (copied) {
+		err = chunk_store(index, page);
+	}
+	put_page(page);
+	return err ? err : copied;
+}
+
+/**
+ * @brief Removes the chunks of the buffer in a range of indexes, in
+ * compressed mode. Called with the lock held.
+ *
+ * @param first index of the first chunk to remove
+ * @param last index of the last chunk to remove
+ */
+static void chunk_remove(pgoff_t first, pgoff_t last)
+{
+	struct chunk *chunk;
+	unsigned long index;
+
+	xa_for_each_range(&buffer.chunks, index, chunk, first, last) {
+		xa_erase(&buffer.chunks, index);
+		cache_set(index, 0, chunk->id, NULL);
+		atomic_long_sub(chunk_size(chunk), &buffer.stored);
+		chunk_put(chunk);
+	}
+}
+
+/**
+ * @brief Replaces a page of the buffer shared with a snapshot by a copy, so
+ * the snapshot keeps the old data. The page is unmapped, the mappings fault
+ * the copy in on their next access. Doesn't need the lock.
+ *
+ * @param mapping the mappings of the device
+ * @param index index of the page in the buffer
+ * @param page the page shared, with a reference held by the caller
+ *
+ * @return 0 if the page was replaced, by this call or another one, or
+ *         -ENOMEM
+ */
+static int buffer_unshare_page(struct address_space *mapping, pgoff_t index,
+			       struct page *page)
+{
+	struct page *copy = alloc_page(GFP_HIGHUSER);
+	struct page *old;
+
+	if (!copy) {
+		return -ENOMEM;
+	}
+	copy_highpage(copy, page);
+	// Against a fault mapping the old page, like buffer_remove_pages
+	lock_page(page);
+	xa_lock(&buffer.pages);
+	old = __xa_cmpxchg(&buffer.pages, index, page, copy, GFP_ATOMIC);
+	if (old == page) {
+		__xa_clear_mark(&buffer.pages, index, SNAPSHOT_MARK);
+	}
+	xa_unlock(&buffer.pages);
+	unlock_page(page);
+
+	if (old != page) {
+		// Replaced or removed meanwhile
+		__free_page(copy);
+		return 0;
+	}
+	// The reference of the buffer, the snapshot keeps its own
+	put_page(page);
+	unmap_mapping_range(mapping, (loff_t)index << PAGE_SHIFT, PAGE_SIZE, 0);
+	return 0;
+}
+
+/**
+ * @brief Returns the page of the buffer at an index with a reference held,
+ * allocating it if it is absent and copying it if it is shared with a
+ * snapshot, so it can be changed. Called with the lock held.
+ *
+ * @param mapping the mappings of the device
+ * @param index index of the page in the buffer
+ *
+ * @return The page, or NULL if it could not be allocated.
+ */
+static struct page *buffer_get_page_write(struct address_space *mapping,
+					  pgoff_t index)
+{
+	struct page *page = buffer_get_page(index);
+
+	while (page && xa_get_mark(&buffer.pages, index, SNAPSHOT_MARK)) {
+		const int err = buffer_unshare_page(mapping, index, page);
+
+		put_page(page);
+		if (err) {
+			return NULL;
+		}
+		page = buffer_get_page(index);
+	}
+	return page;
+}
+
+/**
+ * @brief Returns a page holding the data of the buffer at an index, with a
+ * reference held, in either mode. Doesn't need the lock.
+ *
+ * @param index index of the page in the buffer
+ *
+ * @return The page, NULL for a hole, or an ERR_PTR.
+ */
+static struct page *buffer_read_page(pgoff_t index)
+{
+	return buffer_compressed() ? chunk_read(index) :
+				     buffer_find_page(index);
+}
+
+/**
+ * @brief Writes to the data of the buffer at an index, in either mode.
+ * Called with the lock held.
+ *
+ * @param mapping the mappings of the device
+ * @param index index of the page in the buffer
+ * @param offset offset in the page of the first byte to write
+ * @param n number of bytes to write, within the page
+ * @param from source of the data
+ *
+ * @return Number of bytes written, or a negative error code
+ */
+static ssize_t buffer_write_page(struct address_space *mapping, pgoff_t index,
+				 size_t offset, size_t n, struct iov_iter *from)
+{
+	struct page *page;
+	size_t copied;
+
+	// Chunks are never changed, a snapshot keeps the old one
+	if (buffer_compressed()) {
+		return chunk_write(index, offset, n, from);
+	}
+	page = buffer_get_page_write(mapping, index);
+	if (!page) {
+		return -ENOMEM;
+	}
+	copied = copy_page_from_iter(page, offset, n, from);
+	put_page(page);
+	return copied;
+}
+
+/**
+ * @brief Removes the pages of the buffer in a range of indexes and drops
+ * their reference. They stay allocated while mapped or read, the caller
+ * unmaps them afterward. Called with the lock held.
+ *
+ * @param first index of the first page to remove
+ * @param last index of the last page to remove
+ */
+static void buffer_remove_pages(pgoff_t first, pgoff_t last)
+{
+	struct page *page;
+	unsigned long index;
+
+	if (buffer_compressed()) {
+		chunk_remove(first, last);
+		return;
+	}
+	xa_for_each_range(&buffer.pages, index, page, first, last) {
+		// Waits for a fault mapping the page, see parrot_vm_fault
+		lock_page(page);
+		xa_erase(&buffer.pages, index);
+		unlock_page(page);
+		put_page(page);
+		atomic_long_sub(PAGE_SIZE, &buffer.stored);
+	}
+}
+
+/**
+ * @brief Zeroes a part of a page of the buffer, if it is present. Called
+ * with the lock held.
+ *
+ * @param mapping the mappings of the device
+ * @param start position in the buffer of the first byte to zero
+ * @param end position after the last byte to zero, in the same page
+ *
+ * @return 0, or a negative error code
+ */
+static int buffer_zero(struct address_space *mapping, loff_t start,
+		       loff_t end)
+{
+	const pgoff_t index = start >> PAGE_SHIFT;
+	struct page *page;
+	int err;
+
+	if (start >= end) {
+		return 0;
+	}
+	if (!buffer_compressed()) {
+		if (!xa_load(&buffer.pages, index)) {
+			return 0;
+		}
+		page = buffer_get_page_write(mapping, index);
+		if (!page) {
+			return -ENOMEM;
+		}
+		memzero_page(page, offset_in_page(start), end - start);
+		put_page(page);
+		return 0;
+	}
+	if (!xa_load(&buffer.chunks, index)) {
+		return 0;
+	}
+	page = alloc_page(GFP_HIGHUSER);
+	if (!page) {
+		return -ENOMEM;
+	}
+	err = chunk_fill(index, page);
+	if (!err) {
+		memzero_page(page, offset_in_page(start), end - start);
+		err = chunk_store(index, page);
+	}
+	put_page(page);
+	return err;
+}
+
+/**
+ * @brief Returns a page decompressed from a chunk that can't change, with a
+ * reference held. The page comes from the cache, or is decompressed and
+ * cached.
+ *
+ * @param index index of the page in the buffer
+ * @param chunk the chunk, a reference is held by the caller
+ *
+ * @return The page, or an ERR_PTR.
+ */
+static struct page *chunk_page(pgoff_t index, const struct chunk *chunk)
+{
+	struct page *page = cache_get(index, chunk->id);
+	int err;
+
+	if (page) {
+		return page;
+	}
+	page = alloc_page(GFP_HIGHUSER);
+	if (!page) {
+		return ERR_PTR(-ENOMEM);
+	}
+	err = chunk_decompress(chunk, page);
+	if (err) {
+		put_page(page);
+		return ERR_PTR(err);
+	}
+	cache_set(index, chunk->id, 0, page);
+	return page;
+}
+
+/**
+ * @brief Returns a page holding the data of a snapshot at an index, with a
+ * reference held.
+ *
+ * @param snap the snapshot
+ * @param index index of the page in the snapshot
+ *
+ * @return The page, NULL for a hole, or an ERR_PTR.
+ */
+static struct page *snapshot_read_page(struct snapshot *snap, pgoff_t index)
+{
+	void *entry = xa_load(&snap->data, index);
+
+	if (!entry) {
+		return NULL;
+	}
+	if (buffer_compressed()) {
+		return chunk_page(index, entry);
+	}
+	get_page(entry);
+	return entry;
+}
+
+/**
+ * @brief Copies data of the buffer or of a snapshot to an iterator, without
+ * any lock. A copy of the buffer may be torn by a concurrent write, the
+ * caller checks the sequence count to know if it has to try again.
+ *
+ * @param snap the snapshot to read, NULL to read the buffer
+ * @param to destination of the data, advanced by the number of bytes copied
+ * @param pos position in the data of the first byte to read
+ *
+ * @return Actual number of bytes read, 0 past the end of the data, or
+ *         a negative error code if nothing could be copied
+ */
+static ssize_t buffer_copy_to_iter(struct snapshot *snap, struct iov_iter *to,
+				   loff_t pos)
+{
+	const size_t size = snap ? snap->size : READ_ONCE(buffer.size);
+	size_t count = iov_iter_count(to);
+	size_t done = 0;
+
+	if (pos >= size) {
+		return 0;
+	}
+	if (pos + count > size) {
+		count = size - pos;
+	}
+	while (done < count) {
+		const size_t offset = offset_in_page(pos + done);
+		const size_t n = min_t(size_t, count - done, PAGE_SIZE - offset);
+		const pgoff_t index = (pos + done) >> PAGE_SHIFT;
+		struct page *page = snap ? snapshot_read_page(snap, index) :
+					   buffer_read_page(index);
+		size_t copied;
+
+		if (IS_ERR(page)) {
+			if (done == 0) {
+				return PTR_ERR(page);
+			}
+			break;
+		}
+		// A hole is not allocated and reads as zeros
+		if (page) {
+			copied = copy_page_to_iter(page, offset, n, to);
+			put_page(page);
+		} else {
+			copied = iov_iter_zero(n, to);
+		}
+		done += copied;
+		if (copied < n) {
+			if (done == 0) {
+				return -EFAULT;
+			}
+			break;
+		}
+	}
+	return done;
+}
+
+/**
+ * @brief Read back previously written data in the internal buffer, from the
+ * position given by the request, so pread and preadv work too.
+ * Readers don't take the lock: they copy the data and start over if a write
+ * happened meanwhile. Only if a writer is busy or the data keeps changing
+ * they wait for the lock.
+ *
+ * @param iocb the request, ki_pos is the position of the first byte to read
+ *             and will be updated to new location
+ * @param to destination of the data
+ *
+ * @return Actual number of bytes read from internal buffer,
+ *         or a negative error code
+ */
+static ssize_t parrot_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	unsigned int seq;
+	ssize_t ret;
+
+	for (int i = 0; i < READ_RETRIES; ++i) {
+		// Doesn't wait for the writer, unlike read_seqcount_begin
+		seq = raw_read_seqcount(&buffer.seq);
+		if (seq & 1) {
+			break;
+		}
+		ret = buffer_copy_to_iter(NULL, to, iocb->ki_pos);
+		if (!read_seqcount_retry(&buffer.seq, seq)) {
+			goto out;
+		}
+		// The copy may be torn, it will be done again
+		if (ret > 0) {
+			iov_iter_revert(to, ret);
+		}
+	}
+
+	if (mutex_lock_interruptible(&buffer.lock)) {
+		return -ERESTARTSYS;
+	}
+	ret = buffer_copy_to_iter(NULL, to, iocb->ki_pos);
+	mutex_unlock(&buffer.lock);
+out:
+	if (ret > 0) {
+		iocb->ki_pos += ret;
+	}
+	return ret;
+}
+
+/**
+ * @brief Write data to the internal buffer at the position given by the
+ * request, so pwrite and pwritev work too. Writing past the end of the data
+ * leaves a hole that reads as zeros but doesn't use any memory.
+ * Writers are serialized by the lock and make the sequence count odd while
+ * they change the data, see parrot_read_iter.
+ *
+ * @param iocb the request, ki_pos is the position to which data will be
+ *             written and will be updated to new location
+ * @param from source of the data
  *
  * @return Actual number of bytes writen to internal buffer,
  *         or a negative error code
  */
-static ssize_t parrot_write(struct file *filp, const char __user *buf,
-			    size_t count, loff_t *ppos)
+static ssize_t parrot_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-	if (*ppos + count >= buffer.capacity) {
-		size_t new_capacity = buffer.capacity;
-		uint8_t *new_buffer = NULL;
+	const unsigned long limit = READ_ONCE(max_size);
+	size_t count = iov_iter_count(from);
+	size_t done = 0;
+	ssize_t ret = 0;
+	loff_t pos;
 
-		if (buffer.capacity == MAX_BUFFER_CAPACITY) {
-			pr_info("Buffer at max capacity\n");
-			return -ENOMEM;
+	if (mutex_lock_interruptible(&buffer.lock)) {
+		return -ERESTARTSYS;
+	}
+	if (iocb->ki_flags & IOCB_APPEND) {
+		iocb->ki_pos = buffer.size;
+	}
+	pos = iocb->ki_pos;
+	if (pos >= limit) {
+		mutex_unlock(&buffer.lock);
+		return -EFBIG;
+	}
+	if (count > limit - pos) {
+		count = limit - pos;
+	}
+	// Associated to the lock, the count leaves preemption enabled for the
+	// copies from user space. Readers never spin on it.
+	write_seqcount_begin(&buffer.seq);
+	while (done < count) {
+		const size_t offset = offset_in_page(pos + done);
+		const size_t n = min_t(size_t, count - done, PAGE_SIZE - offset);
+		ssize_t copied = buffer_write_page(iocb->ki_filp->f_mapping,
+						   (pos + done) >> PAGE_SHIFT,
+						   offset, n, from);
+
+		if (copied < 0) {
+			ret = copied;
+			break;
+		}
+		done += copied;
+		if (copied < n) {
+			ret = -EFAULT;
+			break;
 		}
-		new_capacity = buffer.capacity;
+	}
+	// Overwriting data doesn't make it longer
+	if (pos + done > buffer.size) {
+		WRITE_ONCE(buffer.size, pos + done);
+	}
+	write_seqcount_end(&buffer.seq);
+	mutex_unlock(&buffer.lock);
 
-		do {
-			new_capacity *= 2;
-		} while (new_capacity < *ppos + count);
+	// Report the error only if nothing was written
+	if (done > 0) {
+		iocb->ki_pos += done;
+		ret = done;
+	}
+	return ret;
+}
+
+/**
+ * @brief Changes the position in the file. SEEK_END is relative to the end
+ * of the data, SEEK_DATA and SEEK_HOLE find the pages that are allocated or
+ * not, like on a sparse file.
+ *
+ * @param filp pointer to the file descriptor in use
+ * @param offset new position, relative to whence
+ * @param whence SEEK_SET, SEEK_CUR, SEEK_END, SEEK_DATA or SEEK_HOLE
+ *
+ * @return The new position, or a negative error code
+ */
+static loff_t parrot_llseek(struct file *filp, loff_t offset, int whence)
+{
+	const size_t size = READ_ONCE(buffer.size);
+	struct xarray *data =
+		buffer_compressed() ? &buffer.chunks : &buffer.pages;
+	unsigned long index;
 
-		new_buffer = krealloc(buffer.data, new_capacity, GFP_KERNEL);
+	if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+		return generic_file_llseek_size(filp, offset, whence,
+						READ_ONCE(max_size), size);
+	}
+	if (offset < 0 || offset >= size) {
+		return -ENXIO;
+	}
+	index = offset >> PAGE_SHIFT;
+	if (whence == SEEK_DATA) {
+		if (!xa_find(data, &index, ULONG_MAX, XA_PRESENT)) {
+			return -ENXIO;
+		}
+	} else {
+		// The end of the data counts as a hole
+		while (xa_load(data, index)) {
+			index++;
+		}
+	}
+	if ((loff_t)index << PAGE_SHIFT > offset) {
+		offset = (loff_t)index << PAGE_SHIFT;
+	}
+	if (offset >= size) {
+		if (whence == SEEK_DATA) {
+			return -ENXIO;
+		}
+		offset = size;
+	}
+	return vfs_setpos(filp, offset, READ_ONCE(max_size));
+}
 
-		if (!new_buffer) {
-			pr_err("Error reallocating buffer\n");
-			return -ENOMEM;
+/**
+ * @brief Changes the size of the data. The pages past the new size are
+ * freed and unmapped, and the end of the last page is zeroed so a larger
+ * size reads zeros past the old one.
+ *
+ * @param filp pointer to the file descriptor in use
+ * @param size new size of the data in bytes
+ *
+ * @return 0, or a negative error code
+ */
+static int parrot_truncate(struct file *filp, unsigned long size)
+{
+	loff_t end;
+	int ret;
+
+	if (size > READ_ONCE(max_size)) {
+		return -EFBIG;
+	}
+	if (mutex_lock_interruptible(&buffer.lock)) {
+		return -ERESTARTSYS;
+	}
+	write_seqcount_begin(&buffer.seq);
+	// A mapping may have written past the end of the data in its last page
+	end = min_t(loff_t, size, buffer.size);
+	ret = buffer_zero(filp->f_mapping, end, round_up(end, PAGE_SIZE));
+	if (!ret) {
+		buffer_remove_pages(DIV_ROUND_UP(size, PAGE_SIZE), ULONG_MAX);
+		WRITE_ONCE(buffer.size, size);
+	}
+	write_seqcount_end(&buffer.seq);
+	mutex_unlock(&buffer.lock);
+
+	if (!ret) {
+		unmap_mapping_range(filp->f_mapping, round_up(size, PAGE_SIZE),
+				    0, 1);
+	}
+	return ret;
+}
+
+/**
+ * @brief Allocates the pages of a range that are absent, so the writes to it
+ * don't have to. The data and its size don't change. In compressed mode the
+ * memory needed depends on the data, nothing can be allocated in advance.
+ *
+ * @param range the range to allocate, in user space
+ *
+ * @return 0, or a negative error code
+ */
+static int parrot_prealloc(const struct parrot_range __user *range)
+{
+	struct parrot_range r;
+	struct page *page;
+	pgoff_t index;
+	int ret = 0;
+
+	if (buffer_compressed()) {
+		return -EOPNOTSUPP;
+	}
+	if (copy_from_user(&r, range, sizeof(r))) {
+		return -EFAULT;
+	}
+	if (r.length == 0) {
+		return -EINVAL;
+	}
+	if (r.offset >= READ_ONCE(max_size) ||
+	    r.length > READ_ONCE(max_size) - r.offset) {
+		return -EFBIG;
+	}
+	// Against a truncation removing the pages as they are allocated
+	if (mutex_lock_interruptible(&buffer.lock)) {
+		return -ERESTARTSYS;
+	}
+	for (index = r.offset >> PAGE_SHIFT;
+	     index <= (r.offset + r.length - 1) >> PAGE_SHIFT; index++) {
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
 		}
-		buffer.data = new_buffer;
-		buffer.capacity = new_capacity;
+		page = buffer_get_page(index);
+		if (!page) {
+			ret = -ENOMEM;
+			break;
+		}
+		put_page(page);
+		cond_resched();
 	}
+	mutex_unlock(&buffer.lock);
+	return ret;
+}
+
+/**
+ * @brief Zeroes a range of the data and frees the pages it fully covers,
+ * which then read as zeros without using memory. The size of the data
+ * doesn't change.
+ *
+ * @param filp pointer to the file descriptor in use
+ * @param range the range to punch, in user space
+ *
+ * @return 0, or a negative error code
+ */
+static int parrot_punch_hole(struct file *filp,
+			     const struct parrot_range __user *range)
+{
+	struct parrot_range r;
+	loff_t first;
+	loff_t last;
+	loff_t end;
+	int ret;
 
-	if (copy_from_user(buffer.data + *ppos, buf, count) != 0) {
+	if (copy_from_user(&r, range, sizeof(r))) {
 		return -EFAULT;
 	}
-	buffer.size += count;
-	*ppos += count;
+	if (r.length == 0 || r.offset + r.length < r.offset) {
+		return -EINVAL;
+	}
+	if (mutex_lock_interruptible(&buffer.lock)) {
+		return -ERESTARTSYS;
+	}
+	end = min_t(u64, r.offset + r.length, buffer.size);
+	if (r.offset >= end) {
+		mutex_unlock(&buffer.lock);
+		return 0;
+	}
+	// Only the pages fully in the hole are freed, the others are zeroed
+	first = round_up(r.offset, PAGE_SIZE);
+	last = round_down(end, PAGE_SIZE);
+	write_seqcount_begin(&buffer.seq);
+	if (first > last) {
+		ret = buffer_zero(filp->f_mapping, r.offset, end);
+	} else {
+		ret = buffer_zero(filp->f_mapping, r.offset, first);
+		if (!ret) {
+			ret = buffer_zero(filp->f_mapping, last, end);
+		}
+		if (!ret && first < last) {
+			buffer_remove_pages(first >> PAGE_SHIFT,
+					    (last >> PAGE_SHIFT) - 1);
+		}
+	}
+	write_seqcount_end(&buffer.seq);
+	mutex_unlock(&buffer.lock);
+
+	if (!ret && first < last) {
+		unmap_mapping_range(filp->f_mapping, first, last - first, 1);
+	}
+	return ret;
+}
+
+/**
+ * @brief Drops the references of a snapshot to the pages or chunks it
+ * shares with the buffer and frees it.
+ *
+ * @param snap the snapshot
+ */
+static void snapshot_free(struct snapshot *snap)
+{
+	unsigned long index;
+	void *entry;
+
+	xa_for_each(&snap->data, index, entry) {
+		if (buffer_compressed()) {
+			chunk_put(entry);
+		} else {
+			put_page(entry);
+		}
+	}
+	xa_destroy(&snap->data);
+	kfree(snap);
+}
 
-	return count;
+/**
+ * @brief Read callback of a snapshot file, at any position like on the
+ * device. Nothing changes the data of a snapshot, no lock is needed.
+ *
+ * @param iocb the request, ki_pos is the position of the first byte to read
+ *             and will be updated to new location
+ * @param to destination of the data
+ *
+ * @return Actual number of bytes read, or a negative error code
+ */
+static ssize_t snapshot_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	ssize_t ret = buffer_copy_to_iter(iocb->ki_filp->private_data, to,
+					  iocb->ki_pos);
+
+	if (ret > 0) {
+		iocb->ki_pos += ret;
+	}
+	return ret;
+}
+
+/**
+ * @brief Seek callback of a snapshot file, SEEK_END is relative to the end of
+ * the data of the snapshot.
+ */
+static loff_t snapshot_llseek(struct file *filp, loff_t offset, int whence)
+{
+	struct snapshot *snap = filp->private_data;
+
+	return generic_file_llseek_size(filp, offset, whence,
+					READ_ONCE(max_size), snap->size);
+}
+
+/**
+ * @brief Release callback of a snapshot file, frees the snapshot.
+ */
+static int snapshot_release(struct inode *inode, struct file *filp)
+{
+	snapshot_free(filp->private_data);
+	return 0;
+}
+
+static const struct file_operations parrot_snapshot_fops = {
+	.owner = THIS_MODULE,
+	.read_iter = snapshot_read_iter,
+	.llseek = snapshot_llseek,
+	.release = snapshot_release,
+};
+
+/**
+ * @brief Freezes the current data in a snapshot, read through a new file.
+ * The snapshot shares the pages, or the chunks, of the buffer and takes a
+ * reference to each: the writes that follow copy the pages they change,
+ * the chunks are never changed anyway.
+ * The shared pages are unmapped so the writes through a mapping fault and
+ * copy them too, see parrot_vm_page_mkwrite. Writes through a mapping
+ * concurrent with the snapshot may or may not be part of it.
+ *
+ * @param filp pointer to the file descriptor in use
+ *
+ * @return The file descriptor of the snapshot, or a negative error code
+ */
+static int parrot_snapshot(struct file *filp)
+{
+	struct xarray *data =
+		buffer_compressed() ? &buffer.chunks : &buffer.pages;
+	struct snapshot *snap;
+	struct file *file;
+	unsigned long index;
+	void *entry;
+	int err = 0;
+	int fd;
+
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap) {
+		return -ENOMEM;
+	}
+	xa_init(&snap->data);
+	if (mutex_lock_interruptible(&buffer.lock)) {
+		kfree(snap);
+		return -ERESTARTSYS;
+	}
+	snap->size = buffer.size;
+	xa_for_each(data, index, entry) {
+		// Preallocated pages past the end of the data are left out
+		if (index >= DIV_ROUND_UP(snap->size, PAGE_SIZE)) {
+			break;
+		}
+		err = xa_err(xa_store(&snap->data, index, entry, GFP_KERNEL));
+		if (err) {
+			break;
+		}
+		if (buffer_compressed()) {
+			refcount_inc(&((struct chunk *)entry)->ref);
+		} else {
+			get_page(entry);
+			// Waits for a write fault that found the page unmarked
+			// to map it, the unmap below then removes its mapping
+			lock_page(entry);
+			xa_set_mark(&buffer.pages, index, SNAPSHOT_MARK);
+			unlock_page(entry);
+		}
+	}
+	mutex_unlock(&buffer.lock);
+	if (err) {
+		goto err_free;
+	}
+	if (!buffer_compressed()) {
+		unmap_mapping_range(filp->f_mapping, 0, 0, 0);
+	}
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0) {
+		err = fd;
+		goto err_free;
+	}
+	file = anon_inode_getfile("[parrot-snapshot]", &parrot_snapshot_fops,
+				  snap, O_RDONLY);
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		err = PTR_ERR(file);
+		goto err_free;
+	}
+	// Not set for anonymous files, but the snapshot is read at any position
+	file->f_mode |= FMODE_LSEEK | FMODE_PREAD;
+	fd_install(fd, file);
+	return fd;
+
+err_free:
+	snapshot_free(snap);
+	return err;
+}
+
+/**
+ * @brief Device file ioctl callback, to manage the memory used by the data.
+ *        - If the command is PARROT_TRUNCATE, then the argument is the new
+ * size of the data, see parrot_truncate.
+ *        - If the command is PARROT_PREALLOC, then the argument points to a
+ * struct parrot_range whose pages are allocated, see parrot_prealloc.
+ *        - If the command is PARROT_PUNCH_HOLE, then the argument points to a
+ * struct parrot_range that is zeroed and freed, see parrot_punch_hole.
+ *        - If the command is PARROT_SNAPSHOT, then the current data is frozen
+ * and can be read through the file returned, see parrot_snapshot.
+ *
+ * @param filp pointer to the file descriptor in use
+ * @param cmd command value of the ioctl
+ * @param arg argument of the ioctl
+ *
+ * The commands that change the data need a file opened for writing, like
+ * write does.
+ *
+ * @return 0 if ioctl succeed, the file descriptor of the snapshot for
+ * PARROT_SNAPSHOT, -EBADF if the file is not writable, or a negative error
+ * code
+ */
+static long parrot_ioctl(struct file *filp, unsigned int cmd,
+			 unsigned long arg)
+{
+	switch (cmd) {
+	case PARROT_TRUNCATE:
+	case PARROT_PREALLOC:
+	case PARROT_PUNCH_HOLE:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			return -EBADF;
+		}
+		break;
+	}
+
+	switch (cmd) {
+	case PARROT_TRUNCATE:
+		return parrot_truncate(filp, arg);
+	case PARROT_PREALLOC:
+		return parrot_prealloc((struct parrot_range __user *)arg);
+	case PARROT_PUNCH_HOLE:
+		return parrot_punch_hole(filp,
+					 (struct parrot_range __user *)arg);
+	case PARROT_SNAPSHOT:
+		return parrot_snapshot(filp);
+	default:
+		return -ENOTTY;
+	}
+}
+
+/**
+ * @brief Page fault handler of the mappings of the buffer. The pages of the
+ * buffer are mapped directly, a page never written is allocated first.
+ *
+ * @param vmf description of the fault
+ *
+ * The page is returned locked: a truncation or a punched hole locks the pages
+ * it removes, so either it waits for the page to be mapped and unmaps it
+ * afterward, or the fault sees the page was removed and starts over.
+ *
+ * @return VM_FAULT_LOCKED with vmf->page set, VM_FAULT_NOPAGE to retry the
+ * fault, VM_FAULT_SIGBUS past the end of the data or VM_FAULT_OOM if the
+ * page could not be allocated.
+ */
+static vm_fault_t parrot_vm_fault(struct vm_fault *vmf)
+{
+	struct page *page;
+
+	// Like for a file, only the pages holding data can be accessed
+	if (vmf->pgoff >= DIV_ROUND_UP(READ_ONCE(buffer.size), PAGE_SIZE)) {
+		return VM_FAULT_SIGBUS;
+	}
+	// The reference is dropped when the page is unmapped
+	page = buffer_get_page(vmf->pgoff);
+	if (!page) {
+		return VM_FAULT_OOM;
+	}
+	lock_page(page);
+	if (page != xa_load(&buffer.pages, vmf->pgoff)) {
+		unlock_page(page);
+		put_page(page);
+		return VM_FAULT_NOPAGE;
+	}
+	// A page allocated after a truncation stays until the next one
+	if (vmf->pgoff >= DIV_ROUND_UP(READ_ONCE(buffer.size), PAGE_SIZE)) {
+		unlock_page(page);
+		put_page(page);
+		return VM_FAULT_SIGBUS;
+	}
+	vmf->page = page;
+	return VM_FAULT_LOCKED;
+}
+
+/**
+ * @brief Called before a page of a shared mapping becomes writable. A page
+ * shared with a snapshot is copied and unmapped, the fault is then done again
+ * and maps the copy.
+ *
+ * @param vmf description of the fault, vmf->page is the page
+ *
+ * @return VM_FAULT_LOCKED if the page can be written, VM_FAULT_NOPAGE to
+ * retry the fault or VM_FAULT_OOM if the page could not be copied.
+ */
+static vm_fault_t parrot_vm_page_mkwrite(struct vm_fault *vmf)
+{
+	struct page *page = vmf->page;
+
+	lock_page(page);
+	if (page != xa_load(&buffer.pages, vmf->pgoff)) {
+		unlock_page(page);
+		return VM_FAULT_NOPAGE;
+	}
+	// The mark is set before a snapshot unmaps the pages
+	if (!xa_get_mark(&buffer.pages, vmf->pgoff, SNAPSHOT_MARK)) {
+		return VM_FAULT_LOCKED;
+	}
+	unlock_page(page);
+	if (buffer_unshare_page(vmf->vma->vm_file->f_mapping, vmf->pgoff,
+				page)) {
+		return VM_FAULT_OOM;
+	}
+	return VM_FAULT_NOPAGE;
+}
+
+static const struct vm_operations_struct parrot_vm_ops = {
+	.fault = parrot_vm_fault,
+	.page_mkwrite = parrot_vm_page_mkwrite,
+};
+
+/**
+ * @brief Maps the buffer in the address space of the caller, so it can be
+ * read or written in place. A shared mapping writes to the buffer, a private
+ * one gets a copy of the pages it writes to. The pages are mapped on first
+ * access, see parrot_vm_fault. Compressed data has no pages to map.
+ *
+ * @param filp pointer to the file descriptor in use
+ * @param vma the new mapping, vm_pgoff is the offset in pages in the buffer
+ *
+ * @return 0, or -EINVAL in compressed mode
+ */
+static int parrot_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	if (buffer_compressed()) {
+		return -EINVAL;
+	}
+	vma->vm_ops = &parrot_vm_ops;
+	return 0;
 }
 
 /**
  * @brief uevent callback to set the permission on the device file
  *
- * @param dev pointer to the device
+ * @param dev pointer to the device, const since 6.2
  * @param env ueven environnement corresponding to the device
  */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+static int parrot_uevent(const struct device *dev, struct kobj_uevent_env *env)
+#else
 static int parrot_uevent(struct device *dev, struct kobj_uevent_env *env)
+#endif
 {
 	// Set the permissions of the device file
 	add_uevent_var(env, "DEVMODE=%#o", 0666);
 	return 0;
 }
 
+/**
+ * @brief Sysfs show callback of the size of the data in bytes.
+ */
+static ssize_t size_show(struct device *device, struct device_attribute *attr,
+			 char *buf)
+{
+	return sysfs_emit(buf, "%zu\n", READ_ONCE(buffer.size));
+}
+
+static DEVICE_ATTR_RO(size);
+
+/**
+ * @brief Sysfs show callback of the number of bytes of memory used to store
+ * the data: its pages, or its chunks in compressed mode. The pages cached in
+ * compressed mode are not counted.
+ */
+static ssize_t stored_show(struct device *device,
+			   struct device_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%ld\n", atomic_long_read(&buffer.stored));
+}
+
+static DEVICE_ATTR_RO(stored);
+
+static struct attribute *parrot_attrs[] = {
+	&dev_attr_size.attr,
+	&dev_attr_stored.attr,
+	NULL,
+};
+
+ATTRIBUTE_GROUPS(parrot);
+
 static const struct file_operations parrot_fops = {
 	.owner = THIS_MODULE,
-	.read = parrot_read,
-	.write = parrot_write,
-	.llseek = default_llseek, // Use default to enable seeking to 0
+	.read_iter = parrot_read_iter,
+	.write_iter = parrot_write_iter,
+	.unlocked_ioctl = parrot_ioctl,
+	.mmap = parrot_mmap,
+	.llseek = parrot_llseek,
 };
 
+/**
+ * @brief Frees the data, the cache and the memory of the compression.
+ */
+static void buffer_free(void)
+{
+	struct chunk *chunk;
+	struct page *page;
+	unsigned long index;
+
+	xa_for_each(&buffer.pages, index, page) {
+		put_page(page);
+	}
+	xa_destroy(&buffer.pages);
+	xa_for_each(&buffer.chunks, index, chunk) {
+		kfree(chunk);
+	}
+	xa_destroy(&buffer.chunks);
+	for (int i = 0; i < CACHE_SLOTS; ++i) {
+		if (cache.pages[i]) {
+			put_page(cache.pages[i]);
+		}
+	}
+	vfree(buffer.lz4_wrkmem);
+	kfree(buffer.lz4_dst);
+}
+
 static int __init parrot_init(void)
 {
 	int err;
 
+	if (compress && !PARROT_LZ4) {
+		pr_err("Parrot: The kernel is built without LZ4\n");
+		return -EOPNOTSUPP;
+	}
+
+	// The buffer must be ready before the device can be opened
+	xa_init(&buffer.pages);
+	buffer.size = 0;
+	mutex_init(&buffer.lock);
+	seqcount_mutex_init(&buffer.seq, &buffer.lock);
+	xa_init(&buffer.chunks);
+	buffer.next_id = 1;
+	atomic_long_set(&buffer.stored, 0);
+	spin_lock_init(&cache.lock);
+	if (buffer_compressed()) {
+		buffer.lz4_wrkmem = vmalloc(LZ4_MEM_COMPRESS);
+		buffer.lz4_dst =
+			kmalloc(LZ4_COMPRESSBOUND(PAGE_SIZE), GFP_KERNEL);
+		if (!buffer.lz4_wrkmem || !buffer.lz4_dst) {
+			buffer_free();
+			return -ENOMEM;
+		}
+	}
+
 	// Register the device
 	err = register_chrdev_region(MAJMIN, 1, DEVICE_NAME);
 	if (err != 0) {
 		pr_err("Parrot: Registering char device failed\n");
+		buffer_free();
 		return err;
 	}
 
+	// The owner argument was dropped in 6.4
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	cl = class_create(DEVICE_NAME);
+#else
 	cl = class_create(THIS_MODULE, DEVICE_NAME);
+#endif
 	if (cl == NULL) {
 		pr_err("Parrot: Error creating class\n");
 		err = -1;
@@ -147,7 +1549,8 @@ static int __init parrot_init(void)
 	}
 	cl->dev_uevent = parrot_uevent;
 
-	if (device_create(cl, NULL, MAJMIN, NULL, DEVICE_NAME) == NULL) {
+	if (device_create_with_groups(cl, NULL, MAJMIN, NULL, parrot_groups,
+				      DEVICE_NAME) == NULL) {
 		pr_err("Parrot: Error creating device\n");
 		err = -1;
 		goto err_device_create;
@@ -159,28 +1562,18 @@ static int __init parrot_init(void)
 		pr_err("Parrot: Adding char device failed\n");
 		goto err_cdev_add;
 	}
-	buffer.data = kmalloc(START_BUFFER_CAPACITY, GFP_KERNEL);
-
-	if (!buffer.data) {
-		pr_err("Parrot: Error allocating buffer\n");
-		err = -ENOMEM;
-		goto err_buffer_create;
-	}
-	buffer.size = 0;
-	buffer.capacity = START_BUFFER_CAPACITY;
 
-	pr_info("Parrot ready!\n");
+	pr_info("Parrot ready%s!\n", buffer_compressed() ? ", compressed" : "");
 
 	return 0;
 
-err_buffer_create:
-	kfree(buffer.data);
 err_cdev_add:
 	device_destroy(cl, MAJMIN);
 err_device_create:
 	class_destroy(cl);
 err_class_create:
 	unregister_chrdev_region(MAJMIN, 1);
+	buffer_free();
 	return err;
 }
 
@@ -191,7 +1584,7 @@ static void __exit parrot_exit(void)
 	device_destroy(cl, MAJMIN);
 	class_destroy(cl);
 	unregister_chrdev_region(MAJMIN, 1);
-	kfree(buffer.data);
+	buffer_free();
 	pr_info("Parrot done!\n");
 }
 
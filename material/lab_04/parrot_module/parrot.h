@@ -0,0 +1,41 @@
+#ifndef PARROT_H
+#define PARROT_H
+
+#ifdef __KERNEL__
+#include <linux/ioctl.h>
+#else
+#include <sys/ioctl.h>
+#endif
+#include <linux/types.h>
+
+#define PARROT_IOC_MAGIC	'p'
+
+/*
+ * The argument is the new size of the data in bytes. The pages past it are
+ * freed, preallocated ones included, and a larger size leaves a hole.
+ */
+#define PARROT_TRUNCATE		_IOW(PARROT_IOC_MAGIC, 0, unsigned long)
+/*
+ * Allocates the pages of a range, so later writes to it don't have to. The
+ * size of the data doesn't change, like fallocate with FALLOC_FL_KEEP_SIZE.
+ */
+#define PARROT_PREALLOC		_IOW(PARROT_IOC_MAGIC, 1, struct parrot_range)
+/*
+ * Zeroes a range and frees the pages it fully covers, which then read as
+ * zeros without using memory. The size of the data doesn't change.
+ */
+#define PARROT_PUNCH_HOLE	_IOW(PARROT_IOC_MAGIC, 2, struct parrot_range)
+/*
+ * Freezes the current data and returns a new file descriptor to read it, at
+ * any position. The snapshot shares the memory of the data: the writes that
+ * follow only copy the pages they change. Closing the file frees it.
+ */
+#define PARROT_SNAPSHOT		_IO(PARROT_IOC_MAGIC, 3)
+
+/* Argument of PARROT_PREALLOC and PARROT_PUNCH_HOLE, in bytes */
+struct parrot_range {
+	__u64 offset;
+	__u64 length;
+};
+
+#endif /* PARROT_H */
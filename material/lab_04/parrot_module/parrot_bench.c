@@ -0,0 +1,598 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../helper/bench_hist.h"
+#include "parrot.h"
+
+#define DEFAULT_DEVICE	    "/dev/parrot"
+#define DEFAULT_DURATION_MS 1000
+#define STORED_ATTR	    "/sys/class/parrot/parrot/stored"
+#define MAX_LIST	    16
+#define MAX_THREADS	    64
+// Chunk of the untimed writes filling the device before a read only case
+#define FILL_CHUNK	    (1024 * 1024)
+
+// One point of the sweep
+struct bench_case {
+	size_t chunk;
+	size_t total;
+	int random;
+	int writers;
+	int readers;
+};
+
+// State of a writer or reader thread
+struct worker {
+	pthread_t thread;
+	const struct bench_case *bc;
+	int index;
+	int is_writer;
+	unsigned int seed;
+	uint64_t bytes;
+	struct histogram hist;
+	// Writes that made the data larger, and the slowest of them
+	uint64_t growths;
+	uint64_t growth_max_ns;
+	uint64_t max_ns;
+	int error;
+};
+
+static const char *device = DEFAULT_DEVICE;
+static long duration_ms = DEFAULT_DURATION_MS;
+
+static pthread_barrier_t start_barrier;
+static volatile int stop;
+// Writers still running, the readers stop with the last one
+static int writers_running;
+// End of the data written so far, the size of the data in the device
+static uint64_t data_end;
+
+/**
+ * @brief Raises the end of the data written so far
+ *
+ * @param end End of a write that just succeeded
+ * @return int 1 if the write made the data larger, 0 otherwise
+ */
+static int raise_data_end(uint64_t end)
+{
+	uint64_t old = __atomic_load_n(&data_end, __ATOMIC_RELAXED);
+
+	while (old < end) {
+		if (__atomic_compare_exchange_n(&data_end, &old, end, 0,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Returns the number of bytes each writer writes, whole chunks of its
+ * part of the total size
+ *
+ * @param bc
+ * @return uint64_t
+ */
+static uint64_t writer_share(const struct bench_case *bc)
+{
+	return bc->total / bc->writers / bc->chunk * bc->chunk;
+}
+
+/**
+ * @brief Returns the offset of the next call of a thread. Sequentially, each
+ * writer goes through its own part of the data from its start and wraps
+ * around, and each reader through the whole data written so far. Randomly,
+ * the offsets are aligned on the chunk size.
+ *
+ * @param w    The thread
+ * @param done Bytes the thread already wrote or read
+ * @param end  End of the range to choose from
+ * @return uint64_t
+ */
+static uint64_t next_offset(struct worker *w, uint64_t done, uint64_t end)
+{
+	const struct bench_case *bc = w->bc;
+	uint64_t part;
+
+	if (bc->random) {
+		return (uint64_t)(rand_r(&w->seed) % (end / bc->chunk)) *
+		       bc->chunk;
+	}
+	if (!w->is_writer) {
+		return done % (end / bc->chunk * bc->chunk);
+	}
+	part = writer_share(bc);
+	return w->index * part + done % part;
+}
+
+/**
+ * @brief Body of the writer and reader threads. A writer writes its part of
+ * the total size and stops, a reader reads the data written so far until
+ * the writers are done. Both stop when the duration of the case is over.
+ *
+ * @param arg The struct worker of the thread
+ * @return void*
+ */
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	const struct bench_case *bc = w->bc;
+	const uint64_t share = w->is_writer ? writer_share(bc) : 0;
+	uint8_t *buffer;
+	uint64_t offset;
+	uint64_t start;
+	uint64_t ns;
+	uint64_t end;
+	ssize_t ret;
+	int fd;
+
+	buffer = malloc(bc->chunk);
+	fd = open(device, w->is_writer ? O_WRONLY : O_RDONLY);
+	if (buffer == NULL || fd < 0) {
+		w->error = errno;
+		pthread_barrier_wait(&start_barrier);
+		free(buffer);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+	// Text like data, so the compressed mode has something to do
+	for (size_t i = 0; i < bc->chunk; i++) {
+		buffer[i] = "parrot says: hello\n"[i % 19];
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	while (!stop) {
+		if (w->is_writer) {
+			if (w->bytes >= share) {
+				break;
+			}
+			offset = next_offset(w, w->bytes, bc->total);
+		} else {
+			end = __atomic_load_n(&data_end, __ATOMIC_RELAXED);
+			if (end < bc->chunk) {
+				if (!__atomic_load_n(&writers_running,
+						     __ATOMIC_RELAXED)) {
+					break;
+				}
+				sched_yield();
+				continue;
+			}
+			offset = next_offset(w, w->bytes, end);
+		}
+
+		start = now_ns();
+		ret = w->is_writer ? pwrite(fd, buffer, bc->chunk, offset) :
+				     pread(fd, buffer, bc->chunk, offset);
+		ns = now_ns() - start;
+		if (ret <= 0) {
+			w->error = ret < 0 ? errno : EIO;
+			break;
+		}
+		hist_add(&w->hist, ns);
+		w->bytes += ret;
+		if (ns > w->max_ns) {
+			w->max_ns = ns;
+		}
+		if (w->is_writer && raise_data_end(offset + ret)) {
+			w->growths++;
+			if (ns > w->growth_max_ns) {
+				w->growth_max_ns = ns;
+			}
+		}
+		if (!w->is_writer && bc->writers &&
+		    !__atomic_load_n(&writers_running, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+	if (w->is_writer) {
+		__atomic_sub_fetch(&writers_running, 1, __ATOMIC_RELAXED);
+	}
+
+	close(fd);
+	free(buffer);
+	return NULL;
+}
+
+/**
+ * @brief Reads the memory used by the data from sysfs
+ *
+ * @return long Bytes of memory, -1 if the attribute can't be read
+ */
+static long read_stored(void)
+{
+	FILE *file = fopen(STORED_ATTR, "r");
+	long stored = -1;
+
+	if (file == NULL) {
+		return -1;
+	}
+	if (fscanf(file, "%ld", &stored) != 1) {
+		stored = -1;
+	}
+	fclose(file);
+	return stored;
+}
+
+/**
+ * @brief Empties the device for a case, and fills it when the case has no
+ * writers so the readers have something to read
+ *
+ * @param fd
+ * @param bc
+ * @return int 0 on success, -1 with errno set otherwise
+ */
+static int setup_data(int fd, const struct bench_case *bc)
+{
+	uint8_t *buffer;
+	size_t n;
+
+	data_end = 0;
+	if (ioctl(fd, PARROT_TRUNCATE, 0UL) < 0) {
+		return -1;
+	}
+	if (bc->writers) {
+		return 0;
+	}
+
+	buffer = calloc(1, FILL_CHUNK);
+	if (buffer == NULL) {
+		return -1;
+	}
+	for (size_t done = 0; done < bc->total; done += n) {
+		n = bc->total - done < FILL_CHUNK ? bc->total - done :
+						    FILL_CHUNK;
+		if (pwrite(fd, buffer, n, done) != (ssize_t)n) {
+			free(buffer);
+			return -1;
+		}
+	}
+	free(buffer);
+	data_end = bc->total;
+	return 0;
+}
+
+/**
+ * @brief Runs one case of the sweep and writes its CSV line
+ *
+ * @param fd  Control file of the device
+ * @param bc  The case to run
+ * @param csv Output of the results
+ * @return int 0 on success, -1 otherwise
+ */
+static int run_case(int fd, const struct bench_case *bc, FILE *csv)
+{
+	const int nb_workers = bc->writers + bc->readers;
+	struct worker *workers;
+	struct histogram *write_hist;
+	struct histogram *read_hist;
+	uint64_t write_bytes = 0;
+	uint64_t read_bytes = 0;
+	uint64_t growths = 0;
+	uint64_t growth_max_ns = 0;
+	uint64_t write_max_ns = 0;
+	uint64_t start;
+	double seconds;
+	int rc = -1;
+	int i;
+
+	if (bc->chunk * (bc->writers ? bc->writers : 1) > bc->total) {
+		fprintf(stderr, "Skipping chunk %zu total %zu: too small\n",
+			bc->chunk, bc->total);
+		return 0;
+	}
+	if (setup_data(fd, bc) < 0) {
+		perror("setup:");
+		return -1;
+	}
+
+	workers = calloc(nb_workers, sizeof(*workers));
+	write_hist = calloc(1, sizeof(*write_hist));
+	read_hist = calloc(1, sizeof(*read_hist));
+	if (workers == NULL || write_hist == NULL || read_hist == NULL) {
+		perror("calloc:");
+		goto end;
+	}
+
+	stop = 0;
+	writers_running = bc->writers;
+	pthread_barrier_init(&start_barrier, NULL, nb_workers + 1);
+	for (i = 0; i < nb_workers; i++) {
+		workers[i].bc = bc;
+		workers[i].is_writer = i < bc->writers;
+		workers[i].index = workers[i].is_writer ? i : i - bc->writers;
+		workers[i].seed = i + 1;
+		if (pthread_create(&workers[i].thread, NULL, worker_run,
+				   &workers[i]) != 0) {
+			// Can't recover from a missing thread at the barrier
+			perror("pthread_create:");
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_barrier_wait(&start_barrier);
+	start = now_ns();
+	// The writers end on their own once the total size is written
+	while (now_ns() - start < duration_ms * 1000000ULL &&
+	       (!bc->writers ||
+		__atomic_load_n(&writers_running, __ATOMIC_RELAXED))) {
+		usleep(1000);
+	}
+	stop = 1;
+	for (i = 0; i < nb_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	seconds = (now_ns() - start) / 1e9;
+	pthread_barrier_destroy(&start_barrier);
+
+	for (i = 0; i < nb_workers; i++) {
+		if (workers[i].error != 0) {
+			fprintf(stderr, "Worker %d failed: %s\n", i,
+				strerror(workers[i].error));
+			goto end;
+		}
+		if (workers[i].is_writer) {
+			hist_merge(write_hist, &workers[i].hist);
+			write_bytes += workers[i].bytes;
+			growths += workers[i].growths;
+			if (workers[i].growth_max_ns > growth_max_ns) {
+				growth_max_ns = workers[i].growth_max_ns;
+			}
+			if (workers[i].max_ns > write_max_ns) {
+				write_max_ns = workers[i].max_ns;
+			}
+		} else {
+			hist_merge(read_hist, &workers[i].hist);
+			read_bytes += workers[i].bytes;
+		}
+	}
+
+	fprintf(csv,
+		"%zu,%zu,%s,%d,%d,%.3f,%.3f,%.3f,%" PRIu64 ",%" PRIu64
+		",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+		",%" PRIu64 ",%" PRIu64 ",%ld\n",
+		bc->chunk, bc->total, bc->random ? "rand" : "seq", bc->writers,
+		bc->readers, seconds, write_bytes / seconds / (1024 * 1024),
+		read_bytes / seconds / (1024 * 1024),
+		hist_percentile(write_hist, 0.5),
+		hist_percentile(write_hist, 0.99),
+		hist_percentile(write_hist, 0.999), write_max_ns, growths,
+		growth_max_ns, hist_percentile(read_hist, 0.5),
+		hist_percentile(read_hist, 0.99),
+		hist_percentile(read_hist, 0.999), read_stored());
+	fflush(csv);
+	fprintf(stderr,
+		"chunk %-7zu total %-9zu %-4s %dw/%dr: write %9.3f MB/s "
+		"p99 %" PRIu64 " ns growth max %" PRIu64 " ns, read %9.3f MB/s "
+		"p99 %" PRIu64 " ns\n",
+		bc->chunk, bc->total, bc->random ? "rand" : "seq", bc->writers,
+		bc->readers, write_bytes / seconds / (1024 * 1024),
+		hist_percentile(write_hist, 0.99), growth_max_ns,
+		read_bytes / seconds / (1024 * 1024),
+		hist_percentile(read_hist, 0.99));
+	rc = 0;
+end:
+	free(workers);
+	free(write_hist);
+	free(read_hist);
+	return rc;
+}
+
+/**
+ * @brief Parses a comma separated list of positive sizes, each one may end
+ * with K or M
+ *
+ * @param arg    The list, eg "1,4K,1M"
+ * @param values Destination of the sizes
+ * @return int Number of values parsed, -1 if the list is invalid
+ */
+static int parse_list(const char *arg, size_t *values)
+{
+	char *end;
+	int count = 0;
+
+	while (*arg != '\0' && count < MAX_LIST) {
+		values[count] = strtoul(arg, &end, 0);
+		if (*end == 'K') {
+			values[count] <<= 10;
+			end++;
+		} else if (*end == 'M') {
+			values[count] <<= 20;
+			end++;
+		}
+		if (end == arg || values[count] == 0) {
+			return -1;
+		}
+		count++;
+		if (*end == '\0') {
+			return count;
+		}
+		if (*end != ',') {
+			return -1;
+		}
+		arg = end + 1;
+	}
+	return -1;
+}
+
+/**
+ * @brief Parses a comma separated list of thread counts, each one written
+ * writers:readers
+ *
+ * @param arg     The list, eg "1:0,0:1,1:1"
+ * @param writers Destination of the writer counts
+ * @param readers Destination of the reader counts
+ * @return int Number of pairs parsed, -1 if the list is invalid
+ */
+static int parse_threads(const char *arg, int *writers, int *readers)
+{
+	int count = 0;
+	int len;
+
+	while (*arg != '\0' && count < MAX_LIST) {
+		if (sscanf(arg, "%d:%d%n", &writers[count], &readers[count],
+			   &len) != 2 ||
+		    writers[count] < 0 || readers[count] < 0 ||
+		    writers[count] + readers[count] < 1 ||
+		    writers[count] + readers[count] > MAX_THREADS) {
+			return -1;
+		}
+		count++;
+		arg += len;
+		if (*arg == '\0') {
+			return count;
+		}
+		if (*arg != ',') {
+			return -1;
+		}
+		arg++;
+	}
+	return -1;
+}
+
+/**
+ * @brief Parses a comma separated list of offset patterns
+ *
+ * @param arg    The list, eg "seq,rand"
+ * @param random Destination of the patterns, 1 for random offsets
+ * @return int Number of patterns parsed, -1 if the list is invalid
+ */
+static int parse_patterns(const char *arg, int *random)
+{
+	char *list = strdup(arg);
+	char *saveptr;
+	int count = 0;
+
+	for (char *name = strtok_r(list, ",", &saveptr); name != NULL;
+	     name = strtok_r(NULL, ",", &saveptr)) {
+		if ((strcmp(name, "seq") != 0 && strcmp(name, "rand") != 0) ||
+		    count == MAX_LIST) {
+			free(list);
+			return -1;
+		}
+		random[count++] = strcmp(name, "rand") == 0;
+	}
+	free(list);
+	return count ? count : -1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -d device     device to benchmark (default %s)\n"
+		"  -c chunks     bytes per read or write, K and M suffixes "
+		"(default 1,64,4K,64K,1M)\n"
+		"  -s totals     bytes written per case (default 1M,16M)\n"
+		"  -a patterns   offsets among seq,rand (default seq,rand)\n"
+		"  -p threads    writers:readers pairs "
+		"(default 1:0,0:1,1:1,4:4)\n"
+		"  -t duration   maximum duration of each case in ms "
+		"(default %d)\n"
+		"  -o file       CSV output (default stdout)\n",
+		name, DEFAULT_DEVICE, DEFAULT_DURATION_MS);
+}
+
+int main(int argc, char **argv)
+{
+	size_t chunks[MAX_LIST] = { 1, 64, 4096, 64 * 1024, 1024 * 1024 };
+	size_t totals[MAX_LIST] = { 1024 * 1024, 16 * 1024 * 1024 };
+	int patterns[MAX_LIST] = { 0, 1 };
+	int writers[MAX_LIST] = { 1, 0, 1, 4 };
+	int readers[MAX_LIST] = { 0, 1, 1, 4 };
+	int nb_chunks = 5;
+	int nb_totals = 2;
+	int nb_patterns = 2;
+	int nb_threads = 4;
+	FILE *csv = stdout;
+	struct bench_case bc;
+	int rc = EXIT_SUCCESS;
+	int opt;
+	int fd;
+
+	while ((opt = getopt(argc, argv, "d:c:s:a:p:t:o:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'c':
+			nb_chunks = parse_list(optarg, chunks);
+			break;
+		case 's':
+			nb_totals = parse_list(optarg, totals);
+			break;
+		case 'a':
+			nb_patterns = parse_patterns(optarg, patterns);
+			break;
+		case 'p':
+			nb_threads = parse_threads(optarg, writers, readers);
+			break;
+		case 't':
+			duration_ms = strtol(optarg, NULL, 0);
+			break;
+		case 'o':
+			csv = fopen(optarg, "w");
+			if (csv == NULL) {
+				perror("fopen:");
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	if (nb_chunks < 0 || nb_totals < 0 || nb_patterns < 0 ||
+	    nb_threads < 0 || duration_ms <= 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fd = open(device, O_RDWR);
+	if (fd < 0) {
+		printf("Error opening %s\n", device);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(csv, "chunk,total,pattern,writers,readers,seconds,"
+		     "write_mb_per_s,read_mb_per_s,"
+		     "write_p50_ns,write_p99_ns,write_p999_ns,write_max_ns,"
+		     "growths,growth_max_ns,"
+		     "read_p50_ns,read_p99_ns,read_p999_ns,stored_bytes\n");
+	for (int c = 0; c < nb_chunks; c++) {
+		for (int s = 0; s < nb_totals; s++) {
+			for (int a = 0; a < nb_patterns; a++) {
+				for (int t = 0; t < nb_threads; t++) {
+					bc.chunk = chunks[c];
+					bc.total = totals[s];
+					bc.random = patterns[a];
+					bc.writers = writers[t];
+					bc.readers = readers[t];
+					if (run_case(fd, &bc, csv) < 0) {
+						rc = EXIT_FAILURE;
+						goto end;
+					}
+				}
+			}
+		}
+	}
+end:
+	// Don't leave the last case's data in memory
+	ioctl(fd, PARROT_TRUNCATE, 0UL);
+	close(fd);
+	if (csv != stdout) {
+		fclose(csv);
+	}
+	return rc;
+}
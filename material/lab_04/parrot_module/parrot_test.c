@@ -1,10 +1,456 @@
+// For SEEK_DATA
+#define _GNU_SOURCE
+#include <errno.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include "parrot.h"
 
 #define NB_DATA 128
+// Well over the 1024 bytes the driver used to be limited to, spans many pages
+#define LARGE_SIZE (4 * 1024 * 1024)
+// A block spanning several pages, rewritten while readers check it
+#define BLOCK_SIZE (3 * 4096 + 100)
+#define NB_READERS 4
+#define NB_REWRITES 1000
+// Size of the hole left by writing past the end of the data
+#define HOLE_SIZE (1024 * 1024)
+// Data frozen by a snapshot, spans a few pages
+#define SNAPSHOT_SIZE (2 * 4096 + 50)
+#define COMPRESS_PARAM "/sys/module/parrot/parameters/compress"
+#define ATTR_DIR "/sys/class/parrot/parrot/"
+
+// The module stores the data compressed, it can't be mapped nor preallocated
+static int compressed;
+
+static int fd_concurrent;
+static volatile int writer_done;
+
+/**
+ * @brief Reads a number from a sysfs file.
+ *
+ * @param path path of the file
+ * @param value where to store the number
+ * @return 0 on success, -1 otherwise
+ */
+static int read_attr(const char *path, long *value)
+{
+	FILE *file = fopen(path, "r");
+	int rc;
+
+	if (!file) {
+		return -1;
+	}
+	rc = fscanf(file, "%ld", value) == 1 ? 0 : -1;
+	fclose(file);
+	return rc;
+}
+
+/**
+ * @brief Tells if the module was loaded with compress=1.
+ */
+static int is_compressed(void)
+{
+	FILE *file = fopen(COMPRESS_PARAM, "r");
+	int c;
+
+	if (!file) {
+		return 0;
+	}
+	c = fgetc(file);
+	fclose(file);
+	return c == 'Y';
+}
+
+/**
+ * @brief Writes a large pattern after the data already written and reads it
+ * back.
+ *
+ * @param fd file descriptor of the device, positioned at the end of the data
+ * @return 0 if the data read back is correct, -1 otherwise
+ */
+static int check_large(int fd)
+{
+	uint8_t *large = malloc(LARGE_SIZE);
+	uint8_t *large_read = malloc(LARGE_SIZE);
+	off_t start = lseek(fd, 0, SEEK_CUR);
+	ssize_t done;
+	int rc = -1;
+	int i;
+
+	if (!large || !large_read || start < 0) {
+		goto end;
+	}
+	for (i = 0; i < LARGE_SIZE; i++) {
+		large[i] = i * 7 + (i >> 12);
+	}
+
+	for (i = 0; i < LARGE_SIZE; i += done) {
+		done = write(fd, large + i, LARGE_SIZE - i);
+		if (done <= 0) {
+			perror("write");
+			goto end;
+		}
+	}
+	lseek(fd, start, SEEK_SET);
+	for (i = 0; i < LARGE_SIZE; i += done) {
+		done = read(fd, large_read + i, LARGE_SIZE - i);
+		if (done <= 0) {
+			perror("read");
+			goto end;
+		}
+	}
+	if (memcmp(large, large_read, LARGE_SIZE) == 0) {
+		rc = 0;
+	}
+end:
+	free(large);
+	free(large_read);
+	return rc;
+}
+
+/**
+ * @brief Checks the first data through a shared mapping, then changes it in
+ * place and reads it back.
+ *
+ * @param fd file descriptor of the device, holding at least NB_DATA bytes
+ * @return 0 if the mapping shows the data and writes to it, -1 otherwise
+ */
+static int check_mmap(int fd)
+{
+	uint8_t datas_read[NB_DATA];
+	uint8_t *map;
+	int rc = -1;
+	int i;
+
+	map = mmap(NULL, NB_DATA, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	// There are no pages to map in compressed mode
+	if (compressed) {
+		return map == MAP_FAILED ? 0 : -1;
+	}
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	for (i = 0; i < NB_DATA; i++) {
+		if (map[i] != i) {
+			goto end;
+		}
+		map[i] = ~i;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	if (read(fd, datas_read, NB_DATA) != NB_DATA) {
+		goto end;
+	}
+	for (i = 0; i < NB_DATA; i++) {
+		if (datas_read[i] != (uint8_t)~i) {
+			goto end;
+		}
+	}
+	rc = 0;
+end:
+	munmap(map, NB_DATA);
+	return rc;
+}
+
+/**
+ * @brief Reads the block again and again until the writer is done.
+ *
+ * @param arg unused
+ * @return (void *)1 if a read showed a block half rewritten, NULL otherwise
+ */
+static void *reader(void *arg)
+{
+	uint8_t block[BLOCK_SIZE];
+	int i;
+
+	(void)arg;
+	while (!writer_done) {
+		if (pread(fd_concurrent, block, BLOCK_SIZE, 0) != BLOCK_SIZE) {
+			return (void *)1;
+		}
+		for (i = 1; i < BLOCK_SIZE; i++) {
+			if (block[i] != block[0]) {
+				return (void *)1;
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * @brief Rewrites a block with a new uniform value while readers check that
+ * they never see a mix of two values.
+ *
+ * The data at the start of the device is overwritten.
+ *
+ * @param fd file descriptor of the device
+ * @return 0 if no reader saw a partial write, -1 otherwise
+ */
+static int check_concurrent(int fd)
+{
+	uint8_t block[BLOCK_SIZE];
+	pthread_t readers[NB_READERS];
+	void *torn;
+	int rc = 0;
+	int i;
+
+	memset(block, 0, BLOCK_SIZE);
+	if (pwrite(fd, block, BLOCK_SIZE, 0) != BLOCK_SIZE) {
+		return -1;
+	}
+
+	fd_concurrent = fd;
+	writer_done = 0;
+	for (i = 0; i < NB_READERS; i++) {
+		pthread_create(&readers[i], NULL, reader, NULL);
+	}
+	for (i = 1; i <= NB_REWRITES; i++) {
+		memset(block, i, BLOCK_SIZE);
+		if (pwrite(fd, block, BLOCK_SIZE, 0) != BLOCK_SIZE) {
+			rc = -1;
+			break;
+		}
+	}
+	writer_done = 1;
+	for (i = 0; i < NB_READERS; i++) {
+		pthread_join(readers[i], &torn);
+		if (torn) {
+			rc = -1;
+		}
+	}
+	return rc;
+}
+
+/**
+ * @brief Writes past the end of the data, leaving a hole, and checks that
+ * the hole reads as zeros. Uses the vectored and positioned calls, and checks
+ * that overwriting data doesn't make it longer.
+ *
+ * @param fd file descriptor of the device
+ * @return 0 if the hole and the data are correct, -1 otherwise
+ */
+static int check_sparse(int fd)
+{
+	const char head[] = "parrot";
+	const char tail[] = "sparse";
+	char head_read[sizeof(head)];
+	char tail_read[sizeof(tail)];
+	struct iovec iov[2];
+	uint8_t *hole = malloc(HOLE_SIZE);
+	const off_t end = lseek(fd, 0, SEEK_END);
+	const off_t data = end + HOLE_SIZE;
+	const off_t new_end = data + sizeof(head) + sizeof(tail);
+	int rc = -1;
+	int i;
+
+	if (!hole || end < 0) {
+		goto end;
+	}
+	iov[0] = (struct iovec){ .iov_base = (void *)head,
+				 .iov_len = sizeof(head) };
+	iov[1] = (struct iovec){ .iov_base = (void *)tail,
+				 .iov_len = sizeof(tail) };
+	if (pwritev(fd, iov, 2, data) != new_end - data) {
+		perror("pwritev");
+		goto end;
+	}
+	// Writing again at the same place doesn't change the size
+	if (pwrite(fd, head, sizeof(head), data) != sizeof(head) ||
+	    lseek(fd, 0, SEEK_END) != new_end) {
+		goto end;
+	}
+
+	if (pread(fd, hole, HOLE_SIZE, end) != HOLE_SIZE) {
+		goto end;
+	}
+	for (i = 0; i < HOLE_SIZE; i++) {
+		if (hole[i] != 0) {
+			goto end;
+		}
+	}
+	iov[0].iov_base = head_read;
+	iov[1].iov_base = tail_read;
+	if (preadv(fd, iov, 2, data) != new_end - data ||
+	    memcmp(head, head_read, sizeof(head)) != 0 ||
+	    memcmp(tail, tail_read, sizeof(tail)) != 0) {
+		goto end;
+	}
+	// The pages of the hole are not allocated, the data is found after them
+	if (lseek(fd, (end + 4095) & ~4095, SEEK_DATA) != (data & ~4095)) {
+		goto end;
+	}
+	rc = 0;
+end:
+	free(hole);
+	return rc;
+}
+
+/**
+ * @brief Punches a hole in the data, truncates it and preallocates pages
+ * past its end, and checks the effect of each through the size, the content
+ * and the allocated pages found with SEEK_DATA and SEEK_HOLE. A read only
+ * file can do none of them.
+ *
+ * @param fd file descriptor of the device, holding more than 4 pages of data
+ * @return 0 if each operation did what was expected, -1 otherwise
+ */
+static int check_reclaim(int fd)
+{
+	struct parrot_range range = { .offset = 4096 + 10,
+				      .length = 2 * 4096 };
+	uint8_t data[3 * 4096];
+	off_t size;
+	int refused;
+	int rdonly;
+	int i;
+
+	// Like write, changing the data needs a file opened for writing
+	rdonly = open("/dev/parrot", O_RDONLY);
+	if (rdonly < 0) {
+		return -1;
+	}
+	refused = ioctl(rdonly, PARROT_TRUNCATE, 0) < 0 && errno == EBADF &&
+		  ioctl(rdonly, PARROT_PUNCH_HOLE, &range) < 0 &&
+		  errno == EBADF;
+	close(rdonly);
+	if (!refused) {
+		return -1;
+	}
+
+	// Page 2 is freed, the ends of pages 1 and 3 are only zeroed
+	memset(data, 0xaa, sizeof(data));
+	if (pwrite(fd, data, sizeof(data), 4096) != sizeof(data) ||
+	    ioctl(fd, PARROT_PUNCH_HOLE, &range) < 0 ||
+	    pread(fd, data, sizeof(data), 4096) != sizeof(data)) {
+		return -1;
+	}
+	for (i = 0; i < (int)sizeof(data); i++) {
+		if (data[i] != (i >= 10 && i < 10 + 2 * 4096 ? 0 : 0xaa)) {
+			return -1;
+		}
+	}
+	if (lseek(fd, 4096, SEEK_HOLE) != 2 * 4096 ||
+	    lseek(fd, 2 * 4096, SEEK_DATA) != 3 * 4096) {
+		return -1;
+	}
+
+	// The data past the new size is gone, and zeros once it grows again
+	if (ioctl(fd, PARROT_TRUNCATE, 4096 + 20) < 0 ||
+	    lseek(fd, 0, SEEK_END) != 4096 + 20 ||
+	    ioctl(fd, PARROT_TRUNCATE, 4 * 4096) < 0 ||
+	    pread(fd, data, 40, 4096) != 40) {
+		return -1;
+	}
+	for (i = 0; i < 40; i++) {
+		if (data[i] != (i < 10 ? 0xaa : 0)) {
+			return -1;
+		}
+	}
+	if (lseek(fd, 2 * 4096, SEEK_DATA) >= 0) {
+		return -1;
+	}
+
+	// Preallocated pages are found by SEEK_DATA but don't change the size
+	range = (struct parrot_range){ .offset = 0, .length = 8 * 4096 };
+	size = lseek(fd, 0, SEEK_END);
+	if (compressed) {
+		return ioctl(fd, PARROT_PREALLOC, &range) < 0 ? 0 : -1;
+	}
+	if (ioctl(fd, PARROT_PREALLOC, &range) < 0 ||
+	    lseek(fd, 0, SEEK_END) != size ||
+	    lseek(fd, 2 * 4096, SEEK_DATA) != 2 * 4096) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Takes a snapshot, changes the data through write and through a
+ * mapping, then checks that the snapshot still has the old data and the
+ * device the new one.
+ *
+ * @param fd file descriptor of the device
+ * @return 0 if the snapshot kept the data it froze, -1 otherwise
+ */
+static int check_snapshot(int fd)
+{
+	uint8_t data[SNAPSHOT_SIZE];
+	uint8_t *map = MAP_FAILED;
+	int snap = -1;
+	int rc = -1;
+	off_t size;
+	ssize_t n;
+	int i;
+
+	memset(data, 0x5a, sizeof(data));
+	if (pwrite(fd, data, sizeof(data), 0) != sizeof(data)) {
+		return -1;
+	}
+	// Page 1 is written through a mapping, already writable before the
+	// snapshot
+	if (!compressed) {
+		map = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+			   4096);
+		if (map == MAP_FAILED) {
+			return -1;
+		}
+		map[0] = 0x5a;
+	}
+	size = lseek(fd, 0, SEEK_END);
+	snap = ioctl(fd, PARROT_SNAPSHOT);
+	if (snap < 0) {
+		perror("PARROT_SNAPSHOT");
+		goto end;
+	}
+	// Before any write, so that the fault of the mapping copies the page
+	if (map != MAP_FAILED) {
+		memset(map, 0xa5, 4096);
+	}
+	memset(data, 0xa5, sizeof(data));
+	if (pwrite(fd, data, sizeof(data), 0) != sizeof(data)) {
+		goto end;
+	}
+
+	// Read in small pieces, across the pages
+	for (i = 0; i < (int)sizeof(data); i += n) {
+		n = read(snap, &data[i], 10);
+		if (n <= 0) {
+			goto end;
+		}
+	}
+	for (i = 0; i < (int)sizeof(data); i++) {
+		if (data[i] != 0x5a) {
+			goto end;
+		}
+	}
+	if (lseek(snap, 0, SEEK_END) != size ||
+	    write(snap, data, 1) >= 0 ||
+	    pread(fd, data, sizeof(data), 0) != sizeof(data)) {
+		goto end;
+	}
+	for (i = 0; i < (int)sizeof(data); i++) {
+		if (data[i] != 0xa5) {
+			goto end;
+		}
+	}
+	rc = 0;
+end:
+	if (map != MAP_FAILED) {
+		munmap(map, 4096);
+	}
+	if (snap >= 0) {
+		close(snap);
+	}
+	return rc;
+}
 
 int main(void)
 {
@@ -15,11 +461,14 @@ int main(void)
 	int success;
 	uint8_t datas[NB_DATA];
 	uint8_t datas_read[NB_DATA];
+	long size;
+	long stored;
 
 	fd = open("/dev/parrot", O_RDWR);
 	if (fd < 0) {
 		perror("parrot_test");
 	}
+	compressed = is_compressed();
 
 	// Initialize the datas array
 	printf("Written data are:\n");
@@ -92,5 +541,47 @@ int main(void)
 		printf("Some data are incorrect\n");
 	}
 
+	if (check_large(fd) == 0) {
+		printf("%d more bytes were correct\n", LARGE_SIZE);
+	} else {
+		printf("The %d more bytes are incorrect\n", LARGE_SIZE);
+	}
+
+	if (check_mmap(fd) == 0) {
+		printf("The data were correct through mmap\n");
+	} else {
+		printf("The data are incorrect through mmap\n");
+	}
+
+	if (check_concurrent(fd) == 0) {
+		printf("No read saw a partial write\n");
+	} else {
+		printf("A read saw a partial write\n");
+	}
+
+	if (check_sparse(fd) == 0) {
+		printf("The hole read as zeros\n");
+	} else {
+		printf("The hole or the data around it are incorrect\n");
+	}
+
+	if (check_reclaim(fd) == 0) {
+		printf("Truncating, punching and preallocating worked\n");
+	} else {
+		printf("Truncating, punching or preallocating failed\n");
+	}
+
+	if (check_snapshot(fd) == 0) {
+		printf("The snapshot kept the data it froze\n");
+	} else {
+		printf("The snapshot changed or could not be read\n");
+	}
+
+	if (read_attr(ATTR_DIR "size", &size) == 0 &&
+	    read_attr(ATTR_DIR "stored", &stored) == 0) {
+		printf("%ld bytes of data take %ld bytes of memory%s\n", size,
+		       stored, compressed ? " compressed" : "");
+	}
+
 	return EXIT_SUCCESS;
 }
@@ -2,6 +2,7 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
+#include <linux/kref.h>
 #include <linux/sched.h>
 #include <linux/platform_device.h>
 #include <linux/io.h>
@@ -9,8 +10,22 @@
 #include <linux/of.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
+#include <linux/device.h>
+#include <linux/bits.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/spinlock.h>
+#include <linux/timekeeping.h>
+#include <linux/wait.h>
 #include <asm/io.h>
 
+#include "switch_copy.h"
+
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("REDS");
 MODULE_DESCRIPTION("Introduction to the interrupt and platform drivers");
@@ -20,7 +35,50 @@ MODULE_DESCRIPTION("Introduction to the interrupt and platform drivers");
 #define BTN_DATA_OFFSET		  0x50
 #define BTN_EDGE_CAPTURE_OFFSET	  0x5C
 #define BTN_INTERRUPT_MASK_OFFSET 0x58
+#define BTN_ALL			  0x0F
+#define BTN_COUNT		  4
+
+// Number of events kept until read, must be a power of two
+#define EVENT_RING_SIZE		  64
+// Period over which the interrupt rate is measured
+#define RATE_WINDOW_MS		  100
+// Polls without any edge before going back to interrupts
+#define QUIET_POLLS		  50
+
+static unsigned int debounce_us = 5000;
+module_param(debounce_us, uint, 0644);
+MODULE_PARM_DESC(debounce_us,
+		 "Time a key is ignored after an edge, in microseconds");
+
+static unsigned int storm_threshold = 200;
+module_param(storm_threshold, uint, 0644);
+MODULE_PARM_DESC(storm_threshold,
+		 "Interrupts per second above which the keys are polled");
 
+static unsigned int poll_interval_ms = 10;
+module_param(poll_interval_ms, uint, 0644);
+MODULE_PARM_DESC(poll_interval_ms,
+		 "Period at which the keys are polled, in milliseconds");
+
+/*
+ * The events form a single producer, single consumer ring: the timer is the
+ * only producer and moves head, the readers take read_lock so only one of
+ * them consumes and moves tail at a time. The timer never waits for a
+ * reader, when the ring is full the event is dropped and counted instead.
+ *
+ * An edge masks the interrupt of its key, the timer queues the event once
+ * the key had debounce_us to settle and unmasks it again. Each key has its
+ * own deadline, the timer runs for the first one and re-arms for the next. If
+ * the interrupts come faster than storm_threshold anyway, they are all
+ * masked and the timer polls the edge capture register instead, until the
+ * keys stay quiet for QUIET_POLLS periods, like NAPI does for network cards.
+ * The interrupt and the timer may run on different CPUs, lock protects the
+ * registers and the fields below it.
+ *
+ * The device and each open file hold a reference on the data: a file may
+ * outlive the unbinding of the device, its reads then fail with -ENODEV once
+ * the queued events are read.
+ */
 struct data {
 	void __iomem *sw;
 	void __iomem *leds;
@@ -28,34 +86,493 @@ struct data {
 	void __iomem *btn_interrupt_mask;
 	void __iomem *btn_edge_capture;
 	struct device *dev;
+	int irq;
+	struct miscdevice miscdev;
+	struct kref ref;
+	// Set once the device is unbound, no event is queued anymore
+	bool removed;
+	struct switch_copy_event events[EVENT_RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+	struct mutex read_lock;
+	wait_queue_head_t read_wq;
+	struct hrtimer timer;
+	spinlock_t lock;
+	// Events dropped since the last one queued
+	u32 dropped_since;
+	// Keys whose interrupt is enabled
+	u8 mask;
+	// Edges waiting for the end of the debounce, with the time of the edge
+	// and the end of the debounce of each key
+	u8 pending;
+	ktime_t edge_time[BTN_COUNT];
+	ktime_t settle_time[BTN_COUNT];
+	bool polling;
+	unsigned int quiet_polls;
+	ktime_t window_start;
+	unsigned int window_irqs;
+	// Shown in sysfs, like polling
+	unsigned int irq_rate;
+	unsigned long irqs;
+	unsigned long queued;
+	unsigned long dropped;
+	unsigned long storms;
 };
 
+// The parameters can change at any time, read them once
+static ktime_t debounce_period(void)
+{
+	return us_to_ktime(READ_ONCE(debounce_us));
+}
+
+static ktime_t poll_period(void)
+{
+	return ms_to_ktime(READ_ONCE(poll_interval_ms));
+}
+
 static void rearm_pb_interrupts(struct data *priv)
 {
-	iowrite8(0x0F, priv->btn_edge_capture);
+	iowrite8(BTN_ALL, priv->btn_edge_capture);
 }
 
-static irqreturn_t irq_handler(int irq, void *dev_id)
+/**
+ * @brief Queues an event for the readers, with the state of the switches.
+ * Called from the timer only, with the lock held, never waits.
+ *
+ * @param priv the device
+ * @param time time of the first edge
+ * @param edges the keys that had an edge
+ * @param keys the state of the keys once debounced
+ */
+static void event_push(struct data *priv, ktime_t time, u8 edges, u8 keys)
 {
-	struct data *priv = (struct data *)dev_id;
-	uint8_t pressed = ioread8(priv->btn_edge_capture);
+	const unsigned int head = priv->head;
+	// Acquire: the reader is done with the slot before it is overwritten
+	const unsigned int tail = smp_load_acquire(&priv->tail);
+	struct switch_copy_event *event;
 
-	(void)irq; // unused
+	if (head - tail == EVENT_RING_SIZE) {
+		priv->dropped_since++;
+		priv->dropped++;
+		return;
+	}
+	event = &priv->events[head & (EVENT_RING_SIZE - 1)];
+	event->timestamp_ns = ktime_to_ns(time);
+	event->dropped = priv->dropped_since;
+	event->switches = ioread16(priv->sw);
+	event->edges = edges;
+	event->keys = keys;
+	priv->dropped_since = 0;
+	priv->queued++;
+	// Release: publish the event only once it is fully written
+	smp_store_release(&priv->head, head + 1);
+
+	// Only pay for the wake up when a reader sleeps
+	if (wq_has_sleeper(&priv->read_wq)) {
+		wake_up_interruptible(&priv->read_wq);
+	}
+}
+
+/**
+ * @brief Tells if there are events to read.
+ */
+static bool events_pending(struct data *priv)
+{
+	return smp_load_acquire(&priv->head) != READ_ONCE(priv->tail);
+}
+
+/**
+ * @brief Wait condition of the readers: an event to read, or the device was
+ * unbound and none will come.
+ */
+static bool read_ready(struct data *priv)
+{
+	return events_pending(priv) || READ_ONCE(priv->removed);
+}
+
+/**
+ * @brief Frees the data once the device and every open file released it.
+ */
+static void data_free(struct kref *ref)
+{
+	kfree(container_of(ref, struct data, ref));
+}
+
+/**
+ * @brief Drops the reference of the device, as the last devm action of the
+ * unbinding, after the interrupt is freed.
+ */
+static void data_put(void *priv)
+{
+	kref_put(&((struct data *)priv)->ref, data_free);
+}
 
+/**
+ * @brief Acts on debounced edges: updates the LEDs and queues the event.
+ * Called with the lock held.
+ *
+ * @param priv the device
+ * @param time time of the first edge
+ * @param pressed the keys that had an edge
+ */
+static void keys_changed(struct data *priv, ktime_t time, u8 pressed)
+{
 	if (pressed & 0x01) {
 		iowrite16(ioread16(priv->sw), priv->leds);
 	} else if (pressed & 0x02) {
 		iowrite16(ioread16(priv->leds) >> 1, priv->leds);
 	}
-	rearm_pb_interrupts(priv);
+	event_push(priv, time, pressed, ioread8(priv->btn_data) & BTN_ALL);
+}
+
+/**
+ * @brief Starts the debounce of keys: masks their interrupt until they had
+ * debounce_us to settle. Called with the lock held.
+ *
+ * @param priv the device
+ * @param now time of the edges
+ * @param keys the keys that had an edge
+ */
+static void debounce_start(struct data *priv, ktime_t now, u8 keys)
+{
+	const ktime_t end = ktime_add(now, debounce_period());
+	unsigned int i;
+
+	for (i = 0; i < BTN_COUNT; i++) {
+		if (keys & BIT(i)) {
+			priv->edge_time[i] = now;
+			priv->settle_time[i] = end;
+		}
+	}
+	priv->pending |= keys;
+	priv->mask &= ~keys;
+	iowrite8(priv->mask, priv->btn_interrupt_mask);
+}
+
+// Time of the first pending edge among keys, now if there is none
+static ktime_t first_edge(struct data *priv, u8 keys, ktime_t now)
+{
+	ktime_t first = now;
+	unsigned int i;
+
+	for (i = 0; i < BTN_COUNT; i++) {
+		if ((keys & priv->pending & BIT(i)) &&
+		    ktime_before(priv->edge_time[i], first)) {
+			first = priv->edge_time[i];
+		}
+	}
+	return first;
+}
+
+// End of the first debounce to end, KTIME_MAX if no key is debounced
+static ktime_t next_settle(struct data *priv)
+{
+	ktime_t next = KTIME_MAX;
+	unsigned int i;
+
+	for (i = 0; i < BTN_COUNT; i++) {
+		if ((priv->pending & BIT(i)) &&
+		    ktime_before(priv->settle_time[i], next)) {
+			next = priv->settle_time[i];
+		}
+	}
+	return next;
+}
+
+/**
+ * @brief Counts an interrupt in the rate window and tells if the rate is
+ * above storm_threshold. Called with the lock held, for every interrupt.
+ */
+static bool irq_storm(struct data *priv, ktime_t now)
+{
+	const s64 elapsed = ktime_ms_delta(now, priv->window_start);
+
+	if (elapsed >= RATE_WINDOW_MS) {
+		priv->irq_rate = div64_u64(
+			(u64)priv->window_irqs * MSEC_PER_SEC, elapsed);
+		priv->window_start = now;
+		priv->window_irqs = 0;
+	}
+	priv->window_irqs++;
+	if (priv->window_irqs <=
+	    READ_ONCE(storm_threshold) * RATE_WINDOW_MS / MSEC_PER_SEC) {
+		return false;
+	}
+	// The keys are polled now, the window won't end: at least that rate
+	priv->irq_rate = priv->window_irqs * MSEC_PER_SEC / RATE_WINDOW_MS;
+	return true;
+}
+
+static irqreturn_t irq_handler(int irq, void *dev_id)
+{
+	struct data *priv = (struct data *)dev_id;
+	const ktime_t now = ktime_get();
+	unsigned long flags;
+	uint8_t captured;
+	uint8_t pressed;
+	bool storm;
+
+	(void)irq; // unused
+
+	spin_lock_irqsave(&priv->lock, flags);
+	// Even the interrupts without any edge count, a faulty line storms too
+	priv->irqs++;
+	storm = irq_storm(priv, now);
+	if (priv->polling) {
+		// Raised just before the keys were masked, the timer handles it
+		spin_unlock_irqrestore(&priv->lock, flags);
+		return IRQ_HANDLED;
+	}
+	// The edges of the masked keys are bounces
+	captured = ioread8(priv->btn_edge_capture) & BTN_ALL;
+	iowrite8(captured, priv->btn_edge_capture);
+	pressed = captured & priv->mask;
+	if (pressed) {
+		// The key bounces for a while, ignore it until it settles
+		debounce_start(priv, now, pressed);
+	}
+
+	if (storm) {
+		// Too many interrupts, poll the keys instead
+		priv->polling = true;
+		priv->quiet_polls = 0;
+		priv->storms++;
+		priv->mask = 0;
+		iowrite8(priv->mask, priv->btn_interrupt_mask);
+		hrtimer_start(&priv->timer, poll_period(), HRTIMER_MODE_REL);
+	} else if (pressed &&
+		   (!hrtimer_is_queued(&priv->timer) ||
+		    ktime_before(next_settle(priv),
+				 hrtimer_get_expires(&priv->timer)))) {
+		/*
+		 * Restarting a queued timer would delay the debounce of the
+		 * other keys, it only moves if debounce_us was lowered. The
+		 * callback may be running on another CPU, waiting for the
+		 * lock: it then leaves the timer as we start it.
+		 */
+		hrtimer_start(&priv->timer, next_settle(priv),
+			      HRTIMER_MODE_ABS);
+	}
+	spin_unlock_irqrestore(&priv->lock, flags);
 
 	return IRQ_HANDLED;
 }
 
+/**
+ * @brief Ends the debounces that are due: queues the edges of the keys that
+ * settled and enables their interrupt again, the edges they had meanwhile
+ * being only bounces. The edges of enabled keys the interrupt didn't get yet
+ * start their own debounce. Called with the lock held.
+ *
+ * @param priv the device
+ * @param now time of the call
+ *
+ * @return the end of the next debounce, KTIME_MAX if no key is debounced
+ */
+static ktime_t debounce_end(struct data *priv, ktime_t now)
+{
+	const u8 captured = ioread8(priv->btn_edge_capture) & BTN_ALL;
+	const u8 fresh = captured & priv->mask;
+	u8 settled = 0;
+	unsigned int i;
+
+	for (i = 0; i < BTN_COUNT; i++) {
+		if ((priv->pending & BIT(i)) &&
+		    !ktime_after(priv->settle_time[i], now)) {
+			settled |= BIT(i);
+		}
+	}
+	// The register may clear all the edges whatever is written, keep none
+	iowrite8(captured, priv->btn_edge_capture);
+	if (settled) {
+		keys_changed(priv, first_edge(priv, settled, now), settled);
+		priv->pending &= ~settled;
+		priv->mask |= settled;
+	}
+	debounce_start(priv, now, fresh);
+	return next_settle(priv);
+}
+
+/**
+ * @brief Timer callback. Ends the debounces that are due, see debounce_end.
+ * In polling mode, queues the edges captured since the last poll, and goes
+ * back to interrupts after QUIET_POLLS polls without any.
+ *
+ * The interrupt may start the timer again while we wait for the lock, it is
+ * then queued already and runs for the keys left, we must not move it.
+ *
+ * @param timer the timer of the device
+ *
+ * @return HRTIMER_RESTART to debounce or poll again, HRTIMER_NORESTART
+ * otherwise
+ */
+static enum hrtimer_restart timer_handler(struct hrtimer *timer)
+{
+	struct data *priv = container_of(timer, struct data, timer);
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+	ktime_t now;
+	ktime_t next;
+	u8 edges;
+
+	spin_lock_irqsave(&priv->lock, flags);
+	now = ktime_get();
+	if (!priv->polling) {
+		next = debounce_end(priv, now);
+	} else {
+		edges = (ioread8(priv->btn_edge_capture) | priv->pending) &
+			BTN_ALL;
+		if (edges) {
+			iowrite8(edges, priv->btn_edge_capture);
+			keys_changed(priv, first_edge(priv, edges, now), edges);
+			priv->pending = 0;
+			priv->quiet_polls = 0;
+		} else if (++priv->quiet_polls >= QUIET_POLLS) {
+			// Calm again, back to interrupts
+			priv->polling = false;
+			priv->window_start = now;
+			priv->window_irqs = 0;
+			priv->mask = BTN_ALL;
+			iowrite8(priv->mask, priv->btn_interrupt_mask);
+		}
+		next = priv->polling ? ktime_add(now, poll_period()) :
+				       KTIME_MAX;
+	}
+	if (next != KTIME_MAX && !hrtimer_is_queued(timer)) {
+		hrtimer_set_expires(timer, next);
+		ret = HRTIMER_RESTART;
+	}
+	spin_unlock_irqrestore(&priv->lock, flags);
+	return ret;
+}
+
+/**
+ * @brief Device file open callback. The events are read in order, the file
+ * has no position. The file keeps the data alive until it is released,
+ * misc_deregister can't run while we are called.
+ */
+static int switch_copy_open(struct inode *inode, struct file *filp)
+{
+	struct data *priv =
+		container_of(filp->private_data, struct data, miscdev);
+
+	kref_get(&priv->ref);
+	filp->private_data = priv;
+	return stream_open(inode, filp);
+}
+
+/**
+ * @brief Device file release callback, drops the reference of the file.
+ */
+static int switch_copy_release(struct inode *inode, struct file *filp)
+{
+	struct data *priv = filp->private_data;
+
+	kref_put(&priv->ref, data_free);
+	return 0;
+}
+
+/**
+ * @brief Device file read callback. Returns as many whole events as fit in
+ * the buffer, at least one: waits for it unless the file is non blocking.
+ *
+ * @param filp pointer to the file descriptor in use, its private_data is our
+ * data
+ * @param buf destination buffer in userspace, of struct switch_copy_event
+ * @param count size of buf in bytes
+ * @param ppos unused, the file has no position
+ *
+ * @return Number of bytes read, a multiple of the size of an event,
+ * -EINVAL if buf can't hold one event, -EAGAIN if the file is non blocking
+ * and there is no event, -ENODEV if there is no event and the device was
+ * unbound, or -EFAULT.
+ */
+static ssize_t switch_copy_read(struct file *filp, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct data *priv = filp->private_data;
+	const size_t size = sizeof(struct switch_copy_event);
+	unsigned int head;
+	unsigned int tail;
+	unsigned int first;
+	unsigned int n;
+
+	if (count < size) {
+		return -EINVAL;
+	}
+
+	for (;;) {
+		if (mutex_lock_interruptible(&priv->read_lock)) {
+			return -ERESTARTSYS;
+		}
+		// Acquire: the events up to head are fully written
+		head = smp_load_acquire(&priv->head);
+		tail = priv->tail;
+		if (head != tail) {
+			break;
+		}
+		mutex_unlock(&priv->read_lock);
+		if (READ_ONCE(priv->removed)) {
+			return -ENODEV;
+		}
+		if (filp->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(priv->read_wq, read_ready(priv))) {
+			return -ERESTARTSYS;
+		}
+	}
+
+	// In at most two copies, the ring may wrap around
+	n = min_t(size_t, head - tail, count / size);
+	first = min(n, EVENT_RING_SIZE - (tail & (EVENT_RING_SIZE - 1)));
+	if (copy_to_user(buf, &priv->events[tail & (EVENT_RING_SIZE - 1)],
+			 first * size) ||
+	    copy_to_user(buf + first * size, priv->events,
+			 (n - first) * size)) {
+		mutex_unlock(&priv->read_lock);
+		return -EFAULT;
+	}
+	// Release: the slots are free once copied
+	smp_store_release(&priv->tail, tail + n);
+	mutex_unlock(&priv->read_lock);
+
+	return n * size;
+}
+
+/**
+ * @brief Device file poll callback. The device is readable as soon as an
+ * event is queued, and hung up once it is unbound.
+ */
+static __poll_t switch_copy_poll(struct file *filp, poll_table *wait)
+{
+	struct data *priv = filp->private_data;
+	__poll_t events = 0;
+
+	poll_wait(filp, &priv->read_wq, wait);
+	if (events_pending(priv)) {
+		events |= EPOLLIN | EPOLLRDNORM;
+	}
+	if (READ_ONCE(priv->removed)) {
+		events |= EPOLLHUP;
+	}
+	return events;
+}
+
+static const struct file_operations switch_copy_fops = {
+	.owner = THIS_MODULE,
+	.open = switch_copy_open,
+	.release = switch_copy_release,
+	.read = switch_copy_read,
+	.poll = switch_copy_poll,
+	.llseek = no_llseek,
+};
+
 static int switch_copy_probe(struct platform_device *pdev)
 {
 	void __iomem *base_pointer;
 	struct data *priv;
+	int ret;
 
 	// Get the interrupt number
 	int btn_interrupt = platform_get_irq(pdev, 0);
@@ -64,24 +581,38 @@ static int switch_copy_probe(struct platform_device *pdev)
 		return btn_interrupt;
 	}
 
-	// Allocate memory for our data structure
-	priv = devm_kzalloc(&pdev->dev, sizeof(struct data), GFP_KERNEL);
+	// Allocate memory for our data structure, the open files may keep it
+	// after the device is unbound
+	priv = kzalloc(sizeof(struct data), GFP_KERNEL);
 	if (!priv) {
 		pr_err("Failed to allocate memory\n");
 		return -ENOMEM;
 	}
+	kref_init(&priv->ref);
+	// Registered first so that it runs last, after the interrupt is freed
+	ret = devm_add_action_or_reset(&pdev->dev, data_put, priv);
+	if (ret) {
+		return ret;
+	}
+	// The interrupt and the timer run as soon as it is requested
+	mutex_init(&priv->read_lock);
+	init_waitqueue_head(&priv->read_wq);
+	spin_lock_init(&priv->lock);
+	hrtimer_init(&priv->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	priv->timer.function = timer_handler;
+	priv->mask = BTN_ALL;
+	priv->window_start = ktime_get();
+	priv->irq = btn_interrupt;
 
 	// Get the base address of the device registers
 	base_pointer = devm_platform_ioremap_resource(pdev, 0);
 	if (IS_ERR(base_pointer)) {
-		kfree(priv);
 		return PTR_ERR(base_pointer);
 	}
 
 	// Request the interrupt. This won't make the interrupt fire yet so it's safe to do it here
 	if (devm_request_irq(&pdev->dev, btn_interrupt, irq_handler, 0,
 			     "switch_copy", priv) < 0) {
-		kfree(priv);
 		return -EBUSY;
 	}
 
@@ -96,8 +627,19 @@ static int switch_copy_probe(struct platform_device *pdev)
 	// Set the driver data on the platform bus
 	platform_set_drvdata(pdev, priv);
 
+	// Expose the events to userspace as /dev/switch_copy
+	priv->miscdev.minor = MISC_DYNAMIC_MINOR;
+	priv->miscdev.name = "switch_copy";
+	priv->miscdev.fops = &switch_copy_fops;
+	priv->miscdev.parent = &pdev->dev;
+	ret = misc_register(&priv->miscdev);
+	if (ret) {
+		pr_err("Failed to register the device\n");
+		return ret;
+	}
+
 	//Enabling interrupts on the hardware
-	iowrite8(0xF, priv->btn_interrupt_mask);
+	iowrite8(priv->mask, priv->btn_interrupt_mask);
 
 	// Arming interrupts
 	rearm_pb_interrupts(priv);
@@ -117,17 +659,78 @@ static int switch_copy_remove(struct platform_device *pdev)
 
 	pr_info("Removing driver\n");
 
+	misc_deregister(&priv->miscdev);
+
+	// Neither the interrupt nor the timer can enable the keys again after
+	disable_irq(priv->irq);
+	hrtimer_cancel(&priv->timer);
+
 	// Disabling interrupts
 	iowrite8(0x0, priv->btn_interrupt_mask);
 
 	// Clearing the LEDs
 	iowrite16(0x0, priv->leds);
 
-	// Free the memory
-	kfree(priv);
+	// The files still open can't read anything new, wake their readers
+	WRITE_ONCE(priv->removed, true);
+	wake_up_interruptible(&priv->read_wq);
+
+	// devm drops our reference on the memory, after the interrupt
 	return 0;
 }
 
+/**
+ * @brief Shows the interrupts per second over the last window, 0 if no
+ * interrupt came since.
+ */
+static ssize_t irq_rate_show(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct data *priv = dev_get_drvdata(dev);
+	unsigned int rate = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->lock, flags);
+	if (ktime_ms_delta(ktime_get(), priv->window_start) <
+	    2 * RATE_WINDOW_MS) {
+		rate = priv->irq_rate;
+	}
+	spin_unlock_irqrestore(&priv->lock, flags);
+	return sysfs_emit(buf, "%u\n", rate);
+}
+
+static DEVICE_ATTR_RO(irq_rate);
+
+// One read only file per counter of struct data
+#define SWITCH_COPY_ATTR(field)                                                \
+	static ssize_t field##_show(struct device *dev,                       \
+				    struct device_attribute *attr, char *buf) \
+	{                                                                      \
+		struct data *priv = dev_get_drvdata(dev);                      \
+                                                                               \
+		return sysfs_emit(buf, "%lu\n",                                \
+				  (unsigned long)READ_ONCE(priv->field));      \
+	}                                                                      \
+	static DEVICE_ATTR_RO(field)
+
+SWITCH_COPY_ATTR(irqs);
+SWITCH_COPY_ATTR(queued);
+SWITCH_COPY_ATTR(dropped);
+// Number of times the keys were polled because of too many interrupts
+SWITCH_COPY_ATTR(storms);
+SWITCH_COPY_ATTR(polling);
+
+static struct attribute *switch_copy_attrs[] = {
+	&dev_attr_irq_rate.attr,
+	&dev_attr_irqs.attr,
+	&dev_attr_queued.attr,
+	&dev_attr_dropped.attr,
+	&dev_attr_storms.attr,
+	&dev_attr_polling.attr,
+	NULL,
+};
+ATTRIBUTE_GROUPS(switch_copy);
+
 static const struct of_device_id switch_copy_driver_id[] = {
 	{ .compatible = "drv2024" },
 	{ /* END */ },
@@ -140,6 +743,7 @@ static struct platform_driver switch_copy_driver = {
 		.name = "drv-lab4",
 		.owner = THIS_MODULE,
 		.of_match_table = of_match_ptr(switch_copy_driver_id),
+		.dev_groups = switch_copy_groups,
 	},
 	.probe = switch_copy_probe,
 	.remove = switch_copy_remove,
@@ -0,0 +1,25 @@
+#ifndef SWITCH_COPY_H
+#define SWITCH_COPY_H
+
+#include <linux/types.h>
+
+/*
+ * A key press as read from /dev/switch_copy, once debounced: the edges of a
+ * bouncing key make a single event. A read returns as many whole events as
+ * fit in the buffer, the oldest first, and blocks until there is at least
+ * one unless the file is non blocking.
+ */
+struct switch_copy_event {
+	/* Time of the first edge, CLOCK_MONOTONIC in nanoseconds */
+	__s64 timestamp_ns;
+	/* Events lost just before this one because the queue was full */
+	__u32 dropped;
+	/* State of the switches once debounced */
+	__u16 switches;
+	/* Keys that had an edge, bit n set for KEYn */
+	__u8 edges;
+	/* State of the keys once debounced, bit n for KEYn */
+	__u8 keys;
+};
+
+#endif /* SWITCH_COPY_H */